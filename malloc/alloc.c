@@ -3,37 +3,215 @@
 * CS 241 - Fall 2018
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for mremap
+#endif
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "alloc.h"
 
 typedef struct meta_data {
-	char free;
-	size_t size;
-	// prev empty block
+	// size of the whole block including this word, a multiple of 16, with the
+	// BLOCK_ flags in its low bits
+	size_t size_and_flags;
+	// prev empty block; the links overlay the payload, so they only exist
+	// while the block is free
 	struct meta_data *prev;
 	// next empty block
 	struct meta_data *next;
 } mata_data;
 
-static mata_data* free_lists_head[16];
-static mata_data* free_lists_tail[16];
+// a block in use only carries its size word
+#define HEADER_SIZE sizeof(size_t)
+// a free block's payload holds its two links and its footer
+#define MIN_PAYLOAD (2 * sizeof(mata_data *) + sizeof(size_t))
+
+#define BLOCK_FREE 1
+// previous block in the arena is free, so its last word is a footer holding
+// its payload size
+#define BLOCK_PREV_FREE 2
+// block has its own mapping instead of living in an arena
+#define BLOCK_MMAPPED 4
+// payload has not been written since it was mapped, so calloc does not need
+// to clear it; only meaningful until the block is first freed
+#define BLOCK_ZEROED 8
+#define BLOCK_FLAGS 15
+// block sits in a thread cache; no block on a free list or in an arena is
+// ever mmapped, so the pair is free for this, and free() still sees
+// BLOCK_FREE on a cached block and ignores freeing it again
+#define BLOCK_CACHED (BLOCK_FREE | BLOCK_MMAPPED)
 
 static size_t sizes[] = {8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768, 65536, 131072};
 
-static int defrag_count = 0;
+#ifdef ALLOC_TLSF
+// Two-level segregated fit: the first level splits free blocks by power of
+// two, the second splits each power of two into SL_COUNT equal ranges (below
+// SMALL_BLOCK the second level is simply size / 8). A bit is set in
+// fl_bitmap and sl_bitmap for every non-empty list, so a good fit is found
+// with two find-first-set operations instead of a list scan.
+#define SL_LOG2 4
+#define SL_COUNT (1 << SL_LOG2)
+#define FL_COUNT 16
+#define SMALL_BLOCK (SL_COUNT << 3)
+#define NUM_LISTS (FL_COUNT * SL_COUNT)
+
+static unsigned int fl_bitmap = 0;
+static unsigned int sl_bitmap[FL_COUNT];
+#else
+#define NUM_LISTS 16
+#endif
+
+static mata_data* free_lists_head[NUM_LISTS];
+static mata_data* free_lists_tail[NUM_LISTS];
+
+// requests larger than the last size class get a dedicated mapping, everything
+// else is carved from ARENA_SIZE mappings aligned to their own size, so the
+// arena of a block can be found by masking its address
+#define LARGE_THRESHOLD 131072
+#define ARENA_SIZE (4 << 20)
+// an arena keeps its first ARENA_KEEP bytes resident, and pages above that
+// are handed back with MADV_DONTNEED once ARENA_TRIM_THRESHOLD bytes of them
+// are unused
+#define ARENA_KEEP (128 << 10)
+#define ARENA_TRIM_THRESHOLD (64 << 10)
+
+typedef struct arena {
+	struct arena *next;
+	// end of the carved part of the arena
+	char *top;
+	// highest top since pages were last released
+	char *dirty;
+	// number of blocks in use, including thread cached ones
+	size_t live;
+} arena;
+
+// blocks start HEADER_SIZE bytes before a 16 byte boundary and are a multiple
+// of 16 bytes long, so every payload is 16 byte aligned
+#define ARENA_HEADER_SIZE (((sizeof(arena) + HEADER_SIZE + 15) & ~(size_t)15) - HEADER_SIZE)
+
+// every payload is at least this aligned
+#define MIN_ALIGNMENT 16
+#ifdef ALLOC_CACHE_ALIGN
+// payloads of blocks this large or larger start on a cache line, so objects
+// used by different threads never share one
+#define CACHE_LINE 64
+#endif
+// room needed in front of a payload to move it to an aligned address
+#define MAX_ALIGN_GAP(alignment) ((alignment) + HEADER_SIZE + MIN_PAYLOAD)
+
+static arena *arenas = NULL;
+static arena *current_arena = NULL;
+static size_t page_size = 0;
+
+// protects the free lists and the arenas
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// size classes up to TCACHE_CLASSES-1 (blocks of up to 512 bytes, header
+// included) are served by per-thread magazines, which are refilled from and flushed to the shared free lists in
+// batches of TCACHE_BATCH blocks
+#define TCACHE_CLASSES 7
+#define TCACHE_SIZE 32
+#define TCACHE_BATCH 16
+
+// allocation counters only touched by their own thread and summed when the
+// stats are read
+typedef struct thread_stats {
+	// may go negative when another thread frees our blocks
+	long live_bytes[ALLOC_STATS_CLASSES];
+	unsigned long allocations[ALLOC_STATS_CLASSES];
+} thread_stats;
+
+typedef struct thread_cache {
+	mata_data *blocks[TCACHE_CLASSES][TCACHE_SIZE];
+	int count[TCACHE_CLASSES];
+	char registered;
+	thread_stats stats;
+	// list of all registered threads, for reading their stats
+	struct thread_cache *prev_thread;
+	struct thread_cache *next_thread;
+} thread_cache;
+
+static __thread thread_cache tcache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+
+// protects the thread list and the stats of threads that have exited
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static thread_cache *threads = NULL;
+static thread_stats exited_stats;
+
+// heap wide counters, the first three are protected by heap_lock
+static size_t coalesces = 0;
+static size_t arena_releases = 0;
+static double arena_release_seconds = 0;
+static size_t mapped_bytes = 0;
+static size_t peak_mapped_bytes = 0;
+static volatile sig_atomic_t dump_requested = 0;
 
 
 int get_list_num(size_t);
-mata_data* grow_heap(size_t);
+size_t block_size(mata_data*);
+void set_block_size(mata_data*, size_t);
+void init_block(mata_data*, size_t, size_t);
+void set_prev_free(mata_data*, int);
+char* payload_of(mata_data*);
+mata_data* header_of(void*);
+size_t payload_size(size_t);
+mata_data* grow_heap(size_t, size_t);
 void recycle_block(mata_data*);
 void detach(mata_data*, int);
 void merge_with_next_if_possible(mata_data*);
+mata_data* merge_with_prev_if_possible(mata_data*);
+mata_data* next_in_arena(mata_data*);
+void mark_free(mata_data*);
+void mark_used(mata_data*);
+void coalesce_block(mata_data*);
 void split_block_if_possible(mata_data*, size_t);
 mata_data* find_first_fit(size_t, int);
 mata_data* find_best_fit(size_t, int);
-void defrag(int);
+mata_data* take_free_block(size_t);
+mata_data* take_aligned_block(size_t, size_t);
+mata_data* align_block(mata_data*, size_t, size_t);
+size_t aligned_gap(char*, size_t);
+size_t block_alignment(size_t);
+void *allocate(size_t);
+void *aligned_allocate(size_t, size_t);
+void free_block(mata_data*);
+int get_cache_num(size_t);
+size_t cache_block_size(int);
+int get_free_list_num(size_t);
+size_t get_page_size(void);
+arena* arena_of(mata_data*);
+arena* map_arena(void);
+void trim_arena(arena*, char*);
+void release_arena(arena*);
+mata_data* map_large_block(size_t, size_t);
+char* large_block_mapping(mata_data*, size_t*);
+mata_data* remap_large_block(mata_data*, size_t);
+void extend_at_top(mata_data*, size_t);
+void tcache_init(void);
+void tcache_register(void);
+int tcache_refill(int);
+void tcache_flush(int, int);
+void tcache_destroy(void*);
+void count_live(mata_data*, int);
+void count_mapped(long);
+void request_dump(int);
+void dump_stats_at_exit(void);
+void stats_init(void);
+#ifdef ALLOC_TLSF
+int tlsf_list_num(size_t);
+mata_data* find_good_fit(size_t);
+#endif
 
 /**
  * Allocate space for array in memory
@@ -59,8 +237,10 @@ void defrag(int);
  * @see http://www.cplusplus.com/reference/clibrary/cstdlib/calloc/
  */
 void *calloc(size_t num, size_t size) {
-	void *ptr = malloc(num * size);
-	if (ptr != NULL)
+	// allocate() rather than malloc(), or gcc folds malloc + memset back into a
+	// call to calloc
+	void *ptr = allocate(num * size);
+	if (ptr != NULL && !(header_of(ptr)->size_and_flags & BLOCK_ZEROED))
 		memset(ptr, 0, num * size);
 	return ptr;
 }
@@ -87,35 +267,156 @@ void *calloc(size_t num, size_t size) {
  * @see http://www.cplusplus.com/reference/clibrary/cstdlib/malloc/
  */
 void *malloc(size_t size) {
+	return allocate(size);
+}
+
+/**
+ * Allocate a block of given size, serving the small size classes from the
+ * calling thread's cache
+ */
+void *allocate(size_t size) {
 	if (size == 0) {
 		return NULL;
 	}
-	int list_num = get_list_num(size);
-	if (list_num == 15) {
-		defrag(list_num);
-	} else if (list_num == 14) {
-		defrag_count++;
-		if (defrag_count > 6) {
-			defrag(list_num);
-			defrag_count = 0;
-		}
+	if (!tcache.registered) {
+		tcache_register();
+	}
+	if (dump_requested) {
+		dump_requested = 0;
+		alloc_dump_stats(STDERR_FILENO);
 	}
+	tcache.stats.allocations[get_list_num(size)]++;
+	size_t alignment = block_alignment(size);
 	mata_data *block = NULL;
-	// search for fitting block
-	if (free_lists_head[list_num] != NULL) {
-		block = (get_list_num(size) >= 5) ? find_best_fit(size, list_num) : find_first_fit(size, list_num);
-		if (block != NULL) {
-			detach(block, list_num);
-			block->free = 0;
-			split_block_if_possible(block, size);
-			return (void *)(block + 1);
+	if (size > LARGE_THRESHOLD) {
+		block = map_large_block(size, alignment);
+	} else {
+		size = payload_size(size);
+		int list_num = get_list_num(size);
+		if (list_num < TCACHE_CLASSES) {
+			if (tcache.count[list_num] > 0 || tcache_refill(list_num)) {
+				block = tcache.blocks[list_num][--tcache.count[list_num]];
+				// another thread may be updating BLOCK_PREV_FREE under heap_lock
+				__atomic_and_fetch(&block->size_and_flags, ~(size_t)BLOCK_CACHED, __ATOMIC_RELAXED);
+			}
+		} else {
+			pthread_mutex_lock(&heap_lock);
+			block = take_aligned_block(size, alignment);
+			pthread_mutex_unlock(&heap_lock);
 		}
 	}
-	// ask for more memory
-	block = grow_heap(size);
 	if (block == NULL)
 		return NULL;
-	return (void *)(block + 1);
+	count_live(block, 1);
+	return payload_of(block);
+}
+
+/**
+ * Allocate aligned memory block
+ *
+ * Allocates size bytes of memory whose address is a multiple of alignment,
+ * and stores the address of the allocated memory in *memptr.
+ *
+ * @param memptr
+ *    Where the address of the allocated memory is stored.
+ * @param alignment
+ *    Alignment of the memory block, a power of two multiple of
+ *    sizeof(void *).
+ * @param size
+ *    Size of the memory block, in bytes.
+ *
+ * @return
+ *    0 on success, EINVAL if alignment is not a power of two multiple of
+ *    sizeof(void *), or ENOMEM if the function failed to allocate the
+ *    requested block of memory, in which case *memptr is left unchanged.
+ *
+ * @see http://man7.org/linux/man-pages/man3/posix_memalign.3.html
+ */
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+	if (alignment == 0 || alignment % sizeof(void *) != 0 ||
+			(alignment & (alignment - 1)) != 0) {
+		return EINVAL;
+	}
+	void *ptr = aligned_allocate(alignment, size);
+	if (ptr == NULL && size != 0) {
+		return ENOMEM;
+	}
+	*memptr = ptr;
+	return 0;
+}
+
+/**
+ * Allocate aligned memory block
+ *
+ * Allocates size bytes of memory whose address is a multiple of alignment.
+ *
+ * @param alignment
+ *    Alignment of the memory block, a power of two.
+ * @param size
+ *    Size of the memory block, in bytes.
+ *
+ * @return
+ *    On success, a pointer to the memory block allocated by the function.
+ *
+ *    If alignment is not a power of two, or the function failed to
+ *    allocate the requested block of memory, a null pointer is returned.
+ *
+ * @see http://en.cppreference.com/w/c/memory/aligned_alloc
+ */
+void *aligned_alloc(size_t alignment, size_t size) {
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return aligned_allocate(alignment, size);
+}
+
+/**
+ * Allocate aligned memory block
+ *
+ * Obsolete version of aligned_alloc(), kept for the programs that still
+ * use it.
+ *
+ * @see http://man7.org/linux/man-pages/man3/posix_memalign.3.html
+ */
+void *memalign(size_t alignment, size_t size) {
+	return aligned_alloc(alignment, size);
+}
+
+/**
+ * Allocate a block of given size whose payload is a multiple of alignment.
+ * Aligned blocks bypass the thread caches.
+ */
+void *aligned_allocate(size_t alignment, size_t size) {
+	// or size + alignment below wraps around and sends the request to the
+	// small block path
+	if (size >= PTRDIFF_MAX - MAX_ALIGN_GAP(alignment)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (alignment <= block_alignment(size)) {
+		return allocate(size);
+	}
+	if (size == 0) {
+		return NULL;
+	}
+	if (!tcache.registered) {
+		tcache_register();
+	}
+	tcache.stats.allocations[get_list_num(size)]++;
+	mata_data *block = NULL;
+	if (size + alignment > LARGE_THRESHOLD) {
+		block = map_large_block(size, alignment);
+	} else {
+		size = payload_size(size);
+		pthread_mutex_lock(&heap_lock);
+		block = take_aligned_block(size, alignment);
+		pthread_mutex_unlock(&heap_lock);
+	}
+	if (block == NULL)
+		return NULL;
+	count_live(block, 1);
+	return payload_of(block);
 }
 
 /**
@@ -135,20 +436,46 @@ void *malloc(size_t size) {
  *    passed as argument, no action occurs.
  */
 void free(void *ptr) {
-	if (ptr == NULL || ptr >= sbrk(0)) {
+	if (ptr == NULL) {
 		return;
 	}
-	mata_data* to_free = (mata_data *)ptr - 1;
-	if (to_free->free == 1) {
+	mata_data* to_free = header_of(ptr);
+	if (to_free->size_and_flags & BLOCK_FREE) {
+		return;
+	}
+	if (!tcache.registered) {
+		tcache_register();
+	}
+	if (dump_requested) {
+		dump_requested = 0;
+		alloc_dump_stats(STDERR_FILENO);
+	}
+	if (to_free->size_and_flags & BLOCK_ZEROED) {
+		// another thread may be updating BLOCK_PREV_FREE under heap_lock
+		__atomic_and_fetch(&to_free->size_and_flags, ~(size_t)BLOCK_ZEROED, __ATOMIC_RELAXED);
+	}
+	count_live(to_free, -1);
+	if (to_free->size_and_flags & BLOCK_MMAPPED) {
+		size_t length;
+		char *start = large_block_mapping(to_free, &length);
+		count_mapped(-(long)length);
+		munmap(start, length);
 		return;
 	}
-	merge_with_next_if_possible(to_free);
-	if (get_list_num(to_free->size) >= 5 && (ptr + to_free->size >= sbrk(0))) {
-		sbrk(0 - (to_free->size + sizeof(mata_data)));
+	int cache_num = get_cache_num(block_size(to_free));
+	// a cached block must be aligned enough for every request it may serve
+	if (cache_num >= 0 &&
+			((uintptr_t)ptr & (block_alignment(cache_block_size(cache_num)) - 1)) == 0) {
+		if (tcache.count[cache_num] == TCACHE_SIZE) {
+			tcache_flush(cache_num, TCACHE_BATCH);
+		}
+		__atomic_or_fetch(&to_free->size_and_flags, BLOCK_CACHED, __ATOMIC_RELAXED);
+		tcache.blocks[cache_num][tcache.count[cache_num]++] = to_free;
 		return;
 	}
-	to_free->free = 1;
-	recycle_block(to_free);
+	pthread_mutex_lock(&heap_lock);
+	free_block(to_free);
+	pthread_mutex_unlock(&heap_lock);
 }
 
 /**
@@ -204,23 +531,46 @@ void *realloc(void *ptr, size_t size) {
 		free(ptr);
 		return NULL;
 	}
-	mata_data* to_realloc = (void *)ptr - sizeof(mata_data);
-	if (size <= to_realloc->size) {
-		split_block_if_possible(to_realloc, size);
+	mata_data* to_realloc = header_of(ptr);
+	char mmapped = (to_realloc->size_and_flags & BLOCK_MMAPPED) != 0;
+	if (mmapped) {
+		mata_data* remapped = remap_large_block(to_realloc, size);
+		if (remapped != NULL) {
+			return payload_of(remapped);
+		}
+	}
+	if (size <= block_size(to_realloc)) {
+		if (!mmapped) {
+			count_live(to_realloc, -1);
+			pthread_mutex_lock(&heap_lock);
+			split_block_if_possible(to_realloc, payload_size(size));
+			pthread_mutex_unlock(&heap_lock);
+			count_live(to_realloc, 1);
+		}
 		return ptr;
-	} else {
+	}
+	// growing in place keeps the payload where it is, which may not be
+	// aligned enough for the new size
+	if (!mmapped && ((uintptr_t)ptr & (block_alignment(size) - 1)) == 0) {
+		count_live(to_realloc, -1);
+		pthread_mutex_lock(&heap_lock);
 		merge_with_next_if_possible(to_realloc);
-		if (to_realloc->size >= size) {
-			return ptr;
+		if (block_size(to_realloc) < size && size <= LARGE_THRESHOLD) {
+			extend_at_top(to_realloc, payload_size(size));
 		}
-		void* new_ptr = malloc(size);
-		if (new_ptr == NULL) {
-			return NULL;
+		pthread_mutex_unlock(&heap_lock);
+		count_live(to_realloc, 1);
+		if (block_size(to_realloc) >= size) {
+			return ptr;
 		}
-		memcpy(new_ptr, ptr, to_realloc->size);
-		free(ptr);
-		return new_ptr;
 	}
+	void* new_ptr = malloc(size);
+	if (new_ptr == NULL) {
+		return NULL;
+	}
+	memcpy(new_ptr, ptr, block_size(to_realloc));
+	free(ptr);
+	return new_ptr;
 }
 
 
@@ -228,23 +578,155 @@ void *realloc(void *ptr, size_t size) {
  * Get the index of empty list with given size
  */
 int get_list_num(size_t size) {
-	for (int i = 0; i < 15; ++i) {
-		if (size <= sizes[i]) {
-			return i;
-		}
+	if (size <= sizes[0]) {
+		return 0;
 	}
-	return 15;
+	// sizes[i] is 8 << i, so this is ceil(log2(size)) - 3
+	int list_num = 8 * sizeof(size_t) - __builtin_clzl(size - 1) - 3;
+	return list_num < 15 ? list_num : 15;
 }
 
 /**
- * Increase the heap
+ * Get the payload size of a block
  */
-mata_data* grow_heap(size_t size) {
-	mata_data* new_block = sbrk(sizeof(mata_data) + size);
-	if (new_block == (void*) -1) {
-		return NULL;
+size_t block_size(mata_data* block) {
+	return (block->size_and_flags & ~(size_t)BLOCK_FLAGS) - HEADER_SIZE;
+}
+
+/**
+ * Set the payload size of a block, keeping its flags
+ */
+void set_block_size(mata_data* block, size_t size) {
+	block->size_and_flags = (size + HEADER_SIZE) | (block->size_and_flags & BLOCK_FLAGS);
+}
+
+/**
+ * Write the header of a new block with a payload of given size
+ */
+void init_block(mata_data* block, size_t size, size_t flags) {
+	block->size_and_flags = (size + HEADER_SIZE) | flags;
+}
+
+/**
+ * Set or clear BLOCK_PREV_FREE of a block. The block may be in use, and its
+ * owner may clear BLOCK_ZEROED in the same word without holding heap_lock,
+ * so the update is atomic.
+ */
+void set_prev_free(mata_data* block, int prev_free) {
+	if (prev_free)
+		__atomic_or_fetch(&block->size_and_flags, BLOCK_PREV_FREE, __ATOMIC_RELAXED);
+	else
+		__atomic_and_fetch(&block->size_and_flags, ~(size_t)BLOCK_PREV_FREE, __ATOMIC_RELAXED);
+}
+
+/**
+ * Get the address of a block's payload
+ */
+char* payload_of(mata_data* block) {
+	return (char *)block + HEADER_SIZE;
+}
+
+/**
+ * Get the block a payload belongs to
+ */
+mata_data* header_of(void* ptr) {
+	return (mata_data *)((char *)ptr - HEADER_SIZE);
+}
+
+/**
+ * Get the payload size of the smallest block that can hold a request of
+ * given size: a whole number of 16 byte units with the header, and large
+ * enough to hold the free list links once freed
+ */
+size_t payload_size(size_t size) {
+	size_t total = (size + HEADER_SIZE + 15) & ~(size_t)15;
+	return total < HEADER_SIZE + MIN_PAYLOAD ? MIN_PAYLOAD : total - HEADER_SIZE;
+}
+
+/**
+ * Get the index of the thread cache a block with a payload of given size can
+ * be kept in, or -1 if it is too large. Unlike get_list_num this rounds down,
+ * so every block in cache i, header included, is at least sizes[i] bytes.
+ */
+int get_cache_num(size_t size) {
+	size += HEADER_SIZE;
+	if (size < sizes[0] || size > sizes[TCACHE_CLASSES - 1]) {
+		return -1;
+	}
+	int cache_num = 0;
+	while (cache_num + 1 < TCACHE_CLASSES && size >= sizes[cache_num + 1]) {
+		cache_num++;
+	}
+	return cache_num;
+}
+
+/**
+ * Get the payload size of the blocks a thread cache is refilled with, which
+ * is the largest payload of its size class
+ */
+size_t cache_block_size(int cache_num) {
+	return sizes[cache_num] - HEADER_SIZE;
+}
+
+/**
+ * Get the index of the empty list a free block of given size is kept in.
+ * Blocks small enough to be thread cached are filed by rounding down, so that
+ * every block in list i can serve a request of size class i.
+ */
+int get_free_list_num(size_t size) {
+#ifdef ALLOC_TLSF
+	return tlsf_list_num(size);
+#else
+	int cache_num = get_cache_num(size);
+	if (cache_num >= 0) {
+		return cache_num;
+	}
+	return size < sizes[0] ? 0 : get_list_num(size);
+#endif
+}
+
+/**
+ * Carve a new block with its payload aligned to alignment from the top of an
+ * arena, mapping a new arena if none of them has enough room left
+ */
+mata_data* grow_heap(size_t size, size_t alignment) {
+	size_t needed = HEADER_SIZE + size;
+	if (alignment > MIN_ALIGNMENT) {
+		// end the block where the next block of this alignment can start
+		// without a gap
+		size = ((needed + alignment - 1) & ~(alignment - 1)) - HEADER_SIZE;
+		needed = HEADER_SIZE + size + MAX_ALIGN_GAP(alignment);
+	}
+	arena *target = current_arena;
+	if (target == NULL || target->top + needed > (char *)target + ARENA_SIZE) {
+		for (target = arenas; target != NULL; target = target->next) {
+			if (target->top + needed <= (char *)target + ARENA_SIZE) {
+				break;
+			}
+		}
+		if (target == NULL && (target = map_arena()) == NULL) {
+			return NULL;
+		}
+		current_arena = target;
+	}
+	mata_data* filler = (mata_data *)target->top;
+	size_t gap = aligned_gap(payload_of(filler), alignment);
+	mata_data* new_block = (void *)filler + gap;
+	// nothing above the dirty mark has been written since it was mapped or
+	// released with MADV_DONTNEED
+	char zeroed = payload_of(new_block) >= target->dirty;
+	target->top = payload_of(new_block) + size;
+	if (target->top > target->dirty) {
+		target->dirty = target->top;
+	}
+	target->live++;
+	init_block(new_block, size, zeroed ? BLOCK_ZEROED : 0);
+	if (gap > 0) {
+		// the space skipped to align the payload becomes a free block
+		init_block(filler, gap - HEADER_SIZE, 0);
+		target->live++;
+		free_block(filler);
 	}
-	*new_block = (mata_data){0, size, NULL, NULL};
 	return new_block;
 }
 
@@ -254,7 +736,7 @@ mata_data* grow_heap(size_t size) {
 void recycle_block(mata_data* node) {
     if (node == NULL)
         return;
-	int list_num = get_list_num(node->size);
+	int list_num = get_free_list_num(block_size(node));
 	node->prev = NULL;
 	node->next = free_lists_head[list_num];
 	if (free_lists_head[list_num] == NULL)
@@ -262,6 +744,10 @@ void recycle_block(mata_data* node) {
 	else
 		free_lists_head[list_num]->prev = node;
 	free_lists_head[list_num] = node;
+#ifdef ALLOC_TLSF
+	fl_bitmap |= 1U << (list_num / SL_COUNT);
+	sl_bitmap[list_num / SL_COUNT] |= 1U << (list_num % SL_COUNT);
+#endif
 }
 
 
@@ -274,6 +760,11 @@ void detach(mata_data* node, int list_num) {
 	if (prev == NULL && next == NULL) {
 		free_lists_head[list_num] = NULL;
 		free_lists_tail[list_num] = NULL;
+#ifdef ALLOC_TLSF
+		sl_bitmap[list_num / SL_COUNT] &= ~(1U << (list_num % SL_COUNT));
+		if (sl_bitmap[list_num / SL_COUNT] == 0)
+			fl_bitmap &= ~(1U << (list_num / SL_COUNT));
+#endif
 	} else if (prev == NULL) {
 		next->prev = NULL;
 		free_lists_head[list_num] = next;
@@ -292,11 +783,83 @@ void detach(mata_data* node, int list_num) {
  * Merge given block with its next block if possible.
  */
 void merge_with_next_if_possible(mata_data* node) {
-	mata_data* next_block = (void*)(node + 1) + node->size;
-	if ((void*) next_block < sbrk(0) && next_block->free == 1) {
-		int next_list_num = get_list_num(next_block->size);
+	mata_data* next_block = next_in_arena(node);
+	if (next_block != NULL && (next_block->size_and_flags & BLOCK_CACHED) == BLOCK_FREE) {
+		int next_list_num = get_free_list_num(block_size(next_block));
 		detach(next_block, next_list_num);
-		node->size += sizeof(mata_data) + next_block->size;
+		set_block_size(node, block_size(node) + HEADER_SIZE + block_size(next_block));
+		coalesces++;
+		mata_data* after = next_in_arena(node);
+		if (after != NULL)
+			set_prev_free(after, node->size_and_flags & BLOCK_FREE);
+	}
+}
+
+/**
+ * Merge given block into its previous block if that one is free, using the
+ * footer the previous block left right before our header.
+ * Return the merged block.
+ */
+mata_data* merge_with_prev_if_possible(mata_data* node) {
+	if (!(node->size_and_flags & BLOCK_PREV_FREE)) {
+		return node;
+	}
+	size_t prev_size = *((size_t *)node - 1);
+	mata_data* prev_block = (void*)node - prev_size - HEADER_SIZE;
+	detach(prev_block, get_free_list_num(prev_size));
+	set_block_size(prev_block, prev_size + HEADER_SIZE + block_size(node));
+	coalesces++;
+	return prev_block;
+}
+
+/**
+ * Get the block right after given block in its arena, or NULL if given block
+ * is the last one below the arena top.
+ */
+mata_data* next_in_arena(mata_data* node) {
+	mata_data* next_block = (mata_data *)(payload_of(node) + block_size(node));
+	return (char*) next_block < arena_of(node)->top ? next_block : NULL;
+}
+
+/**
+ * Flag a block as free and write its footer for the next block to find.
+ */
+void mark_free(mata_data* node) {
+	node->size_and_flags |= BLOCK_FREE;
+	*(size_t *)(payload_of(node) + block_size(node) - sizeof(size_t)) = block_size(node);
+	mata_data* next_block = next_in_arena(node);
+	if (next_block != NULL)
+		set_prev_free(next_block, 1);
+}
+
+/**
+ * Flag a block as in use.
+ */
+void mark_used(mata_data* node) {
+	node->size_and_flags &= ~(size_t)BLOCK_FREE;
+	mata_data* next_block = next_in_arena(node);
+	if (next_block != NULL)
+		set_prev_free(next_block, 0);
+}
+
+/**
+ * Coalesce a block that is no longer in use with both of its neighbours if
+ * they are free, then hand it to the top of its arena or to the free lists.
+ * Since this never leaves a free block right below an arena top, new blocks
+ * carved from the top never have a free block before them.
+ * Caller must hold heap_lock.
+ */
+void coalesce_block(mata_data* node) {
+	arena *owner = arena_of(node);
+	// cached blocks are flushed here without passing through free()
+	node->size_and_flags &= ~(size_t)BLOCK_ZEROED;
+	merge_with_next_if_possible(node);
+	node = merge_with_prev_if_possible(node);
+	if (payload_of(node) + block_size(node) >= owner->top) {
+		trim_arena(owner, (char*) node);
+	} else {
+		mark_free(node);
+		recycle_block(node);
 	}
 }
 
@@ -307,12 +870,12 @@ void split_block_if_possible(mata_data* to_split, size_t new_size) {
     if (to_split == NULL) {
         return;
     }
-	if (to_split->size > new_size + sizeof(mata_data) + 4) {
-		mata_data* new_block = (void *)(to_split + 1) + new_size;
-		new_block->size = to_split->size - new_size - sizeof(mata_data);
-		new_block->free = 1;
-		recycle_block(new_block);
-		to_split->size = new_size;
+	size_t size = block_size(to_split);
+	if (size >= new_size + HEADER_SIZE + MIN_PAYLOAD) {
+		mata_data* new_block = (mata_data *)(payload_of(to_split) + new_size);
+		init_block(new_block, size - new_size - HEADER_SIZE, 0);
+		set_block_size(to_split, new_size);
+		coalesce_block(new_block);
 	}
 }
 
@@ -322,7 +885,7 @@ void split_block_if_possible(mata_data* to_split, size_t new_size) {
 mata_data* find_first_fit(size_t size, int list_num) {
 	mata_data* curr = free_lists_head[list_num];
 	while (curr != NULL) {
-		if (curr->size >= size) {
+		if (block_size(curr) >= size) {
 			return curr;
 		}
 		curr = curr->next;
@@ -338,8 +901,8 @@ mata_data* find_best_fit(size_t size, int list_num) {
 	mata_data* best_fit = NULL;
 	mata_data* curr;
 	for (curr = free_lists_head[list_num]; curr; curr = curr->next) {
-		if (curr->size >= size
-				&& ((!best_fit) || (best_fit->size > curr->size))) {
+		if (block_size(curr) >= size
+				&& ((!best_fit) || (block_size(best_fit) > block_size(curr)))) {
 			best_fit = curr;
 		}
 	}
@@ -348,19 +911,520 @@ mata_data* find_best_fit(size_t size, int list_num) {
 
 
 /**
- * Merge blocks with its neighbor if possible
+ * Take a fitting block off the free lists and split it down to size.
+ * Return NULL if there is none. Caller must hold heap_lock.
  */
-void defrag(int list_num) {
-	mata_data *curr = free_lists_head[list_num];
-	while (curr != NULL) {
-		if (curr->free == 1) {
-			merge_with_next_if_possible(curr);
+mata_data* take_free_block(size_t size) {
+#ifdef ALLOC_TLSF
+	mata_data *block = find_good_fit(size);
+	if (block == NULL)
+		return NULL;
+	int list_num = tlsf_list_num(block_size(block));
+#else
+	int list_num = get_list_num(size);
+	if (free_lists_head[list_num] == NULL)
+		return NULL;
+	mata_data *block = (list_num >= 5) ? find_best_fit(size, list_num) : find_first_fit(size, list_num);
+	if (block == NULL)
+		return NULL;
+#endif
+	detach(block, list_num);
+	mark_used(block);
+	arena_of(block)->live++;
+	split_block_if_possible(block, size);
+	return block;
+}
+
+/**
+ * Take a block whose payload is aligned to alignment from the free lists, or
+ * carve one from an arena if none fits. Caller must hold heap_lock.
+ */
+mata_data* take_aligned_block(size_t size, size_t alignment) {
+	mata_data *block;
+	if (alignment <= MIN_ALIGNMENT) {
+		block = take_free_block(size);
+	} else {
+		block = take_free_block(size + MAX_ALIGN_GAP(alignment));
+		if (block != NULL)
+			block = align_block(block, size, alignment);
+	}
+	return block != NULL ? block : grow_heap(size, alignment);
+}
+
+/**
+ * Free the part of a block in use before the first payload address aligned
+ * to alignment, and the part after size bytes from there.
+ * Return the aligned block. Caller must hold heap_lock.
+ */
+mata_data* align_block(mata_data* block, size_t size, size_t alignment) {
+	size_t gap = aligned_gap(payload_of(block), alignment);
+	if (gap > 0) {
+		mata_data* aligned = (void *)block + gap;
+		init_block(aligned, block_size(block) - gap, 0);
+		set_block_size(block, gap - HEADER_SIZE);
+		arena_of(block)->live++;
+		free_block(block);
+		block = aligned;
+	}
+	split_block_if_possible(block, size);
+	return block;
+}
+
+/**
+ * Get how far a block header must move so that its payload, now at given
+ * address, is aligned to alignment. A gap is either 0 or large enough to
+ * hold a free block, so it is always less than MAX_ALIGN_GAP(alignment).
+ */
+size_t aligned_gap(char* payload, size_t alignment) {
+	size_t gap = -(uintptr_t)payload & (alignment - 1);
+	while (gap > 0 && gap < HEADER_SIZE + MIN_PAYLOAD) {
+		gap += alignment;
+	}
+	return gap;
+}
+
+/**
+ * Get the alignment malloc gives the payload of a block of given size
+ */
+size_t block_alignment(size_t size) {
+#ifdef ALLOC_CACHE_ALIGN
+	if (size >= CACHE_LINE) {
+		return CACHE_LINE;
+	}
+#else
+	(void) size;
+#endif
+	return MIN_ALIGNMENT;
+}
+
+#ifdef ALLOC_TLSF
+/**
+ * Get the index of the two-level list a free block of given size belongs to
+ */
+int tlsf_list_num(size_t size) {
+	if (size < SMALL_BLOCK) {
+		return size >> 3;
+	}
+	int msb = 8 * sizeof(size_t) - 1 - __builtin_clzl(size);
+	int fl = msb - (SL_LOG2 + 3) + 1;
+	int sl = (size >> (msb - SL_LOG2)) ^ SL_COUNT;
+	return fl * SL_COUNT + sl;
+}
+
+/**
+ * Find a free block of at least size bytes in constant time, or NULL.
+ * The request is rounded up to the next second level boundary, so that any
+ * block in the first non-empty list at or above it is big enough.
+ */
+mata_data* find_good_fit(size_t size) {
+	if (size >= SMALL_BLOCK) {
+		size += ((size_t)1 << (8 * sizeof(size_t) - 1 - __builtin_clzl(size) - SL_LOG2)) - 1;
+	}
+	int list_num = tlsf_list_num(size);
+	int fl = list_num / SL_COUNT;
+	if (fl >= FL_COUNT) {
+		return NULL;
+	}
+	unsigned int sl_map = sl_bitmap[fl] & (~0U << (list_num % SL_COUNT));
+	if (sl_map == 0) {
+		unsigned int fl_map = fl + 1 < FL_COUNT ? fl_bitmap & (~0U << (fl + 1)) : 0;
+		if (fl_map == 0) {
+			return NULL;
 		}
-		if (((void*) ((char*) curr + sizeof(mata_data) + curr->size)) >= sbrk(0)) {
-			detach(curr, list_num);
-			sbrk(0 - (curr->size + sizeof(mata_data)));
-			return;
+		fl = __builtin_ctz(fl_map);
+		sl_map = sl_bitmap[fl];
+	}
+	return free_lists_head[fl * SL_COUNT + __builtin_ctz(sl_map)];
+}
+#endif
+
+/**
+ * Return a block to the shared free lists, or to its arena if it sits at the
+ * top of it. An arena left without blocks in use is released as a whole.
+ * Caller must hold heap_lock.
+ */
+void free_block(mata_data* to_free) {
+	arena *owner = arena_of(to_free);
+	owner->live--;
+	coalesce_block(to_free);
+	if (owner->live == 0) {
+		release_arena(owner);
+	}
+}
+
+/**
+ * Get the system page size
+ */
+size_t get_page_size(void) {
+	if (page_size == 0) {
+		page_size = sysconf(_SC_PAGESIZE);
+	}
+	return page_size;
+}
+
+/**
+ * Get the arena a (not mmapped) block was carved from
+ */
+arena* arena_of(mata_data* block) {
+	return (arena *)((uintptr_t)block & ~(uintptr_t)(ARENA_SIZE - 1));
+}
+
+/**
+ * Map a new arena aligned to ARENA_SIZE and add it to the arena list.
+ * Caller must hold heap_lock.
+ */
+arena* map_arena(void) {
+	// over-allocate so an aligned arena fits, then unmap the slack
+	char *region = mmap(NULL, 2 * ARENA_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (region == MAP_FAILED) {
+		return NULL;
+	}
+	char *start = (char *)(((uintptr_t)region + ARENA_SIZE - 1) & ~(uintptr_t)(ARENA_SIZE - 1));
+	if (start > region) {
+		munmap(region, start - region);
+	}
+	munmap(start + ARENA_SIZE, region + ARENA_SIZE - start);
+	count_mapped(ARENA_SIZE);
+	arena *new_arena = (arena *)start;
+	new_arena->top = start + ARENA_HEADER_SIZE;
+	new_arena->dirty = new_arena->top;
+	new_arena->live = 0;
+	new_arena->next = arenas;
+	arenas = new_arena;
+	return new_arena;
+}
+
+/**
+ * Lower the top of an arena to new_top, handing the pages above it back to
+ * the system once enough of them are unused. Caller must hold heap_lock.
+ */
+void trim_arena(arena* target, char* new_top) {
+	target->top = new_top;
+	char *keep = (char *)target + ARENA_KEEP;
+	char *start = new_top > keep ? new_top : keep;
+	size_t page_mask = get_page_size() - 1;
+	start = (char *)(((uintptr_t)start + page_mask) & ~(uintptr_t)page_mask);
+	if (target->dirty >= start + ARENA_TRIM_THRESHOLD) {
+		madvise(start, target->dirty - start, MADV_DONTNEED);
+		target->dirty = start;
+	}
+}
+
+/**
+ * Take every free block of an arena without blocks in use off the free lists
+ * and reset the arena to empty. Caller must hold heap_lock.
+ */
+void release_arena(arena* target) {
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	char *first = (char *)target + ARENA_HEADER_SIZE;
+	mata_data *curr = (mata_data *)first;
+	while ((char *)curr < target->top) {
+		mata_data *next = (mata_data *)(payload_of(curr) + block_size(curr));
+		if (curr->size_and_flags & BLOCK_FREE) {
+			detach(curr, get_free_list_num(block_size(curr)));
 		}
-		curr = curr->next;
+		curr = next;
+	}
+	trim_arena(target, first);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	arena_releases++;
+	arena_release_seconds += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/**
+ * Give a large block a mapping of its own, rounded up to whole pages, with
+ * its payload aligned to alignment. The mapping starts on the page holding
+ * the header, which is the start of that page unless the payload had to move
+ * further in for its alignment.
+ */
+mata_data* map_large_block(size_t size, size_t alignment) {
+	if (size >= PTRDIFF_MAX) {
+		return NULL;
+	}
+	size_t page_mask = get_page_size() - 1;
+	size_t length = (2 * HEADER_SIZE + size + alignment + page_mask) & ~page_mask;
+	char *region = mmap(NULL, length, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (region == MAP_FAILED) {
+		return NULL;
+	}
+	char *payload = (char *)(((uintptr_t)region + HEADER_SIZE + alignment - 1) & ~(uintptr_t)(alignment - 1));
+	char *start = (char *)((uintptr_t)(payload - HEADER_SIZE) & ~page_mask);
+	char *end = (char *)(((uintptr_t)payload + size + HEADER_SIZE + page_mask) & ~page_mask);
+	if (start > region) {
+		munmap(region, start - region);
+	}
+	if (end < region + length) {
+		munmap(end, region + length - end);
+	}
+	count_mapped(end - start);
+	mata_data *block = header_of(payload);
+	// the block size must be a multiple of 16, so the last HEADER_SIZE bytes
+	// of the mapping, which the size above leaves room for, are not used
+	init_block(block, ((end - (char *)block) & ~(size_t)15) - HEADER_SIZE,
+			BLOCK_MMAPPED | BLOCK_ZEROED);
+	return block;
+}
+
+/**
+ * Get the start of the mapping of a large block and store its length in
+ * length
+ */
+char* large_block_mapping(mata_data* block, size_t* length) {
+	size_t page_mask = get_page_size() - 1;
+	char *start = (char *)((uintptr_t)block & ~(uintptr_t)page_mask);
+	char *end = (char *)(((uintptr_t)payload_of(block) + block_size(block) + page_mask) & ~(uintptr_t)page_mask);
+	*length = end - start;
+	return start;
+}
+
+/**
+ * Resize a large block's mapping to fit size bytes, moving it if the kernel
+ * cannot grow it where it is. Return the resized block, or NULL if the
+ * mapping could not be resized.
+ */
+mata_data* remap_large_block(mata_data* block, size_t size) {
+	size_t page_mask = get_page_size() - 1;
+	size_t old_length;
+	char *start = large_block_mapping(block, &old_length);
+	size_t offset = (char *)block - start;
+	size_t length = (offset + 2 * HEADER_SIZE + size + page_mask) & ~page_mask;
+	if (length == old_length) {
+		return block;
+	}
+	count_live(block, -1);
+	char *moved = mremap(start, old_length, length, MREMAP_MAYMOVE);
+	if (moved == MAP_FAILED) {
+		count_live(block, 1);
+		return NULL;
+	}
+	count_mapped((long)length - (long)old_length);
+	mata_data *remapped = (mata_data *)(moved + offset);
+	set_block_size(remapped, ((length - offset) & ~(size_t)15) - HEADER_SIZE);
+	count_live(remapped, 1);
+	return remapped;
+}
+
+/**
+ * Grow a block that is the last one below its arena top to new_size by
+ * moving the top, if the arena has room. Caller must hold heap_lock.
+ */
+void extend_at_top(mata_data* block, size_t new_size) {
+	arena *owner = arena_of(block);
+	char *end = payload_of(block) + block_size(block);
+	char *new_end = payload_of(block) + new_size;
+	if (end != owner->top || new_end > (char *)owner + ARENA_SIZE) {
+		return;
+	}
+	owner->top = new_end;
+	if (owner->top > owner->dirty) {
+		owner->dirty = owner->top;
+	}
+	set_block_size(block, new_size);
+}
+
+/**
+ * Create the key whose destructor flushes a thread's cache when it exits
+ */
+void tcache_init(void) {
+	pthread_key_create(&tcache_key, tcache_destroy);
+}
+
+/**
+ * Make sure the calling thread's cache is flushed when the thread exits, and
+ * add it to the list of threads whose stats are summed up
+ */
+void tcache_register(void) {
+	pthread_once(&tcache_once, tcache_init);
+	pthread_setspecific(tcache_key, &tcache);
+	tcache.registered = 1;
+	pthread_mutex_lock(&stats_lock);
+	tcache.prev_thread = NULL;
+	tcache.next_thread = threads;
+	if (threads != NULL)
+		threads->prev_thread = &tcache;
+	threads = &tcache;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+/**
+ * Refill an empty thread cache with up to TCACHE_BATCH blocks, taken from the
+ * shared free list first and carved from an arena otherwise.
+ * Return the number of blocks added.
+ */
+int tcache_refill(int cache_num) {
+	size_t size = cache_block_size(cache_num);
+	int count = 0;
+	pthread_mutex_lock(&heap_lock);
+	while (count < TCACHE_BATCH) {
+		mata_data *block = take_aligned_block(size, block_alignment(size));
+		if (block == NULL) {
+			break;
+		}
+		block->size_and_flags |= BLOCK_CACHED;
+		tcache.blocks[cache_num][count++] = block;
+	}
+	pthread_mutex_unlock(&heap_lock);
+	tcache.count[cache_num] = count;
+	return count;
+}
+
+/**
+ * Move the oldest num blocks of a thread cache back to the shared free lists
+ */
+void tcache_flush(int cache_num, int num) {
+	mata_data **blocks = tcache.blocks[cache_num];
+	if (num > tcache.count[cache_num]) {
+		num = tcache.count[cache_num];
+	}
+	pthread_mutex_lock(&heap_lock);
+	for (int i = 0; i < num; ++i) {
+		blocks[i]->size_and_flags &= ~(size_t)BLOCK_CACHED;
+		free_block(blocks[i]);
+	}
+	pthread_mutex_unlock(&heap_lock);
+	tcache.count[cache_num] -= num;
+	memmove(blocks, blocks + num, tcache.count[cache_num] * sizeof(mata_data*));
+}
+
+/**
+ * Flush every cache of an exiting thread and keep its stats
+ */
+void tcache_destroy(void *data) {
+	(void) data;
+	for (int i = 0; i < TCACHE_CLASSES; ++i) {
+		tcache_flush(i, TCACHE_SIZE);
+	}
+	pthread_mutex_lock(&stats_lock);
+	for (int i = 0; i < ALLOC_STATS_CLASSES; ++i) {
+		exited_stats.live_bytes[i] += tcache.stats.live_bytes[i];
+		exited_stats.allocations[i] += tcache.stats.allocations[i];
+	}
+	if (tcache.prev_thread != NULL)
+		tcache.prev_thread->next_thread = tcache.next_thread;
+	else
+		threads = tcache.next_thread;
+	if (tcache.next_thread != NULL)
+		tcache.next_thread->prev_thread = tcache.prev_thread;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+/**
+ * Add (sign 1) or remove (sign -1) a block to the calling thread's count of
+ * live bytes
+ */
+void count_live(mata_data* block, int sign) {
+	size_t size = block_size(block);
+	int class_num = (block->size_and_flags & BLOCK_MMAPPED) ? ALLOC_STATS_CLASSES - 1 : get_list_num(size);
+	tcache.stats.live_bytes[class_num] += sign * (long) size;
+}
+
+/**
+ * Track the number of bytes mapped and its high-water mark
+ */
+void count_mapped(long delta) {
+	size_t now = __atomic_add_fetch(&mapped_bytes, delta, __ATOMIC_RELAXED);
+	size_t peak = __atomic_load_n(&peak_mapped_bytes, __ATOMIC_RELAXED);
+	while (now > peak && !__atomic_compare_exchange_n(&peak_mapped_bytes, &peak,
+				now, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void alloc_get_stats(alloc_stats *stats) {
+	memset(stats, 0, sizeof(alloc_stats));
+	long live_bytes[ALLOC_STATS_CLASSES];
+	pthread_mutex_lock(&stats_lock);
+	for (int i = 0; i < ALLOC_STATS_CLASSES; ++i) {
+		live_bytes[i] = exited_stats.live_bytes[i];
+		stats->allocations[i] = exited_stats.allocations[i];
+	}
+	for (thread_cache *curr = threads; curr != NULL; curr = curr->next_thread) {
+		for (int i = 0; i < ALLOC_STATS_CLASSES; ++i) {
+			live_bytes[i] += curr->stats.live_bytes[i];
+			stats->allocations[i] += curr->stats.allocations[i];
+		}
+	}
+	pthread_mutex_unlock(&stats_lock);
+	for (int i = 0; i < ALLOC_STATS_CLASSES; ++i) {
+		stats->live_bytes[i] = live_bytes[i] > 0 ? live_bytes[i] : 0;
+	}
+
+	size_t total_free = 0, largest_free = 0;
+	pthread_mutex_lock(&heap_lock);
+	for (int i = 0; i < NUM_LISTS; ++i) {
+		for (mata_data *curr = free_lists_head[i]; curr != NULL; curr = curr->next) {
+			size_t size = block_size(curr);
+			int class_num = get_list_num(size);
+			stats->free_bytes[class_num] += size;
+			stats->free_blocks[class_num]++;
+			total_free += size;
+			if (size > largest_free)
+				largest_free = size;
+		}
+	}
+	stats->coalesces = coalesces;
+	stats->arena_releases = arena_releases;
+	stats->arena_release_seconds = arena_release_seconds;
+	pthread_mutex_unlock(&heap_lock);
+
+	stats->fragmentation = total_free ? 1 - (double) largest_free / total_free : 0;
+	stats->mapped_bytes = __atomic_load_n(&mapped_bytes, __ATOMIC_RELAXED);
+	stats->peak_mapped_bytes = __atomic_load_n(&peak_mapped_bytes, __ATOMIC_RELAXED);
+}
+
+void alloc_dump_stats(int fd) {
+	alloc_stats stats;
+	alloc_get_stats(&stats);
+	// formatted on the stack, since malloc may be what we are reporting on
+	char line[256];
+	int len = snprintf(line, sizeof(line), "%10s %14s %14s %12s %14s\n",
+			"class", "live bytes", "free bytes", "free blocks", "allocations");
+	write(fd, line, len);
+	for (int i = 0; i < ALLOC_STATS_CLASSES; ++i) {
+		char name[16];
+		if (i < ALLOC_STATS_CLASSES - 1)
+			snprintf(name, sizeof(name), "<= %zu", sizes[i]);
+		else
+			snprintf(name, sizeof(name), "> %zu", sizes[i - 1]);
+		len = snprintf(line, sizeof(line), "%10s %14zu %14zu %12zu %14zu\n", name,
+				stats.live_bytes[i], stats.free_bytes[i], stats.free_blocks[i],
+				stats.allocations[i]);
+		write(fd, line, len);
+	}
+	len = snprintf(line, sizeof(line),
+			"mapped %zu bytes (peak %zu), fragmentation %.3f, %zu coalesces, "
+			"%zu arena releases in %.6f s\n",
+			stats.mapped_bytes, stats.peak_mapped_bytes, stats.fragmentation,
+			stats.coalesces, stats.arena_releases, stats.arena_release_seconds);
+	write(fd, line, len);
+}
+
+/**
+ * SIGUSR1 handler. Dumping takes locks, so it is left to the next call to
+ * malloc or free.
+ */
+void request_dump(int signum) {
+	(void) signum;
+	dump_requested = 1;
+}
+
+void dump_stats_at_exit(void) {
+	alloc_dump_stats(STDERR_FILENO);
+}
+
+/**
+ * Set up the stats dumps if ALLOC_STATS is set in the environment
+ */
+__attribute__((constructor)) void stats_init(void) {
+	if (getenv("ALLOC_STATS") == NULL) {
+		return;
 	}
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = request_dump;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGUSR1, &action, NULL);
+	atexit(dump_stats_at_exit);
 }
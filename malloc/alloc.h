@@ -0,0 +1,58 @@
+/**
+* Malloc Lab
+* CS 241 - Fall 2018
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * Number of size classes statistics are kept for. Class i holds blocks of
+ * up to 8 << i bytes, the last class holds everything above 128 KiB.
+ */
+#define ALLOC_STATS_CLASSES 16
+
+/**
+ * Snapshot of the allocator's state, filled in by alloc_get_stats().
+ */
+typedef struct alloc_stats {
+    // bytes of blocks handed out and not yet freed, per size class
+    size_t live_bytes[ALLOC_STATS_CLASSES];
+    // bytes of blocks on the shared free lists, per size class (blocks held
+    // in thread caches are not counted)
+    size_t free_bytes[ALLOC_STATS_CLASSES];
+    // number of blocks on the shared free lists, per size class
+    size_t free_blocks[ALLOC_STATS_CLASSES];
+    // number of malloc/calloc/realloc requests, by requested size class
+    size_t allocations[ALLOC_STATS_CLASSES];
+    // bytes currently mapped for arenas and large blocks, and the maximum
+    size_t mapped_bytes;
+    size_t peak_mapped_bytes;
+    // 1 - (largest free block / free bytes), 0 when nothing is free
+    double fragmentation;
+    // number of times a freed block was merged with a free neighbour
+    size_t coalesces;
+    // number of times an arena ran empty and was swept off the free lists,
+    // and the total time spent doing so
+    size_t arena_releases;
+    double arena_release_seconds;
+} alloc_stats;
+
+/**
+ * Fills in stats with the current state of the allocator.
+ *
+ * Allocation counters are kept per thread and only summed here, so keeping
+ * them enabled costs a couple of increments per call. Walking the free lists
+ * takes the heap lock, so this should not be called in a tight loop.
+ */
+void alloc_get_stats(alloc_stats *stats);
+
+/**
+ * Writes a human readable report of alloc_get_stats() to fd.
+ *
+ * If the ALLOC_STATS environment variable is set when the program starts,
+ * the report is also written to stderr at exit and whenever the process
+ * receives SIGUSR1 (on its next call to malloc or free).
+ */
+void alloc_dump_stats(int fd);
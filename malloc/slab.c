@@ -0,0 +1,159 @@
+/**
+* Malloc Lab
+* CS 241 - Fall 2018
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "slab.h"
+
+// pages are taken from malloc this many at a time, aligned to a page
+#define SLAB_CHUNK_PAGES 16
+
+/**
+ * Header at the start of every slab page, followed by the free slot bitmap
+ * (a set bit is a free slot) and the objects.
+ */
+typedef struct slab {
+	// next slab of the cache with at least one free slot
+	struct slab *next;
+	uint32_t free_count;
+	uint32_t objects;
+} slab;
+
+struct slab_cache {
+	size_t object_size;
+	size_t slab_size;
+	size_t objects_per_slab;
+	size_t bitmap_words;
+	// offset of the first object from the start of a slab
+	size_t first_object;
+	// slabs with at least one free slot
+	slab *partial;
+	// unused pages of the newest chunk
+	char *next_page;
+	char *chunk_end;
+	// every chunk taken from malloc, freed on destroy
+	void **chunks;
+	size_t num_chunks;
+	size_t chunk_capacity;
+	pthread_mutex_t lock;
+};
+
+/** Private. */
+static uint64_t *slab_bitmap(slab *s) {
+	return (uint64_t *)(s + 1);
+}
+
+/** Private. */
+static slab *new_slab(slab_cache *cache) {
+	if (cache->next_page == cache->chunk_end) {
+		if (cache->num_chunks == cache->chunk_capacity) {
+			size_t capacity = cache->chunk_capacity ? 2 * cache->chunk_capacity : 8;
+			void **chunks = realloc(cache->chunks, capacity * sizeof(void *));
+			if (chunks == NULL)
+				return NULL;
+			cache->chunks = chunks;
+			cache->chunk_capacity = capacity;
+		}
+		void *chunk;
+		if (posix_memalign(&chunk, cache->slab_size, SLAB_CHUNK_PAGES * cache->slab_size) != 0)
+			return NULL;
+		cache->chunks[cache->num_chunks++] = chunk;
+		cache->next_page = chunk;
+		cache->chunk_end = cache->next_page + SLAB_CHUNK_PAGES * cache->slab_size;
+	}
+	slab *s = (slab *)cache->next_page;
+	cache->next_page += cache->slab_size;
+	s->next = NULL;
+	s->free_count = cache->objects_per_slab;
+	s->objects = cache->objects_per_slab;
+	uint64_t *bitmap = slab_bitmap(s);
+	memset(bitmap, 0, cache->bitmap_words * sizeof(uint64_t));
+	for (size_t i = 0; i < cache->objects_per_slab; ++i)
+		bitmap[i / 64] |= (uint64_t)1 << (i % 64);
+	return s;
+}
+
+slab_cache *slab_cache_create(size_t object_size) {
+	if (object_size == 0)
+		return NULL;
+	object_size = (object_size + 7) & ~(size_t)7;
+	size_t slab_size = sysconf(_SC_PAGESIZE);
+	// find the largest object count whose header, bitmap and objects fit
+	size_t objects = (slab_size - sizeof(slab)) / object_size;
+	size_t bitmap_words = 0;
+	while (objects > 0) {
+		bitmap_words = (objects + 63) / 64;
+		if (sizeof(slab) + bitmap_words * sizeof(uint64_t) + objects * object_size <= slab_size)
+			break;
+		objects--;
+	}
+	if (objects == 0)
+		return NULL;
+	slab_cache *cache = malloc(sizeof(slab_cache));
+	if (cache == NULL)
+		return NULL;
+	memset(cache, 0, sizeof(slab_cache));
+	cache->object_size = object_size;
+	cache->slab_size = slab_size;
+	cache->objects_per_slab = objects;
+	cache->bitmap_words = bitmap_words;
+	cache->first_object = sizeof(slab) + bitmap_words * sizeof(uint64_t);
+	pthread_mutex_init(&cache->lock, NULL);
+	return cache;
+}
+
+void *slab_alloc(slab_cache *cache) {
+	pthread_mutex_lock(&cache->lock);
+	slab *s = cache->partial;
+	if (s == NULL) {
+		s = new_slab(cache);
+		if (s == NULL) {
+			pthread_mutex_unlock(&cache->lock);
+			return NULL;
+		}
+		cache->partial = s;
+	}
+	uint64_t *bitmap = slab_bitmap(s);
+	size_t word = 0;
+	while (bitmap[word] == 0)
+		word++;
+	size_t index = word * 64 + __builtin_ctzll(bitmap[word]);
+	bitmap[word] &= bitmap[word] - 1;
+	if (--s->free_count == 0) {
+		cache->partial = s->next;
+		s->next = NULL;
+	}
+	pthread_mutex_unlock(&cache->lock);
+	return (char *)s + cache->first_object + index * cache->object_size;
+}
+
+void slab_free(slab_cache *cache, void *object) {
+	if (object == NULL)
+		return;
+	slab *s = (slab *)((uintptr_t)object & ~(uintptr_t)(cache->slab_size - 1));
+	size_t index = ((char *)object - (char *)s - cache->first_object) / cache->object_size;
+	pthread_mutex_lock(&cache->lock);
+	slab_bitmap(s)[index / 64] |= (uint64_t)1 << (index % 64);
+	// a full slab is not on the partial list yet
+	if (s->free_count++ == 0) {
+		s->next = cache->partial;
+		cache->partial = s;
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+void slab_cache_destroy(slab_cache *cache) {
+	if (cache == NULL)
+		return;
+	for (size_t i = 0; i < cache->num_chunks; ++i)
+		free(cache->chunks[i]);
+	free(cache->chunks);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
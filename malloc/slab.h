@@ -0,0 +1,55 @@
+/**
+* Malloc Lab
+* CS 241 - Fall 2018
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * Object cache for fixed-size objects.
+ *
+ * Objects are handed out from page-sized slabs. Every slab starts with a
+ * 16-byte header followed by a bitmap of its free slots, so objects carry no
+ * per-object metadata and allocation never walks a free list. Slab pages are
+ * taken from the malloc heap in chunks and only given back when the cache is
+ * destroyed.
+ *
+ * A cache is safe to use from several threads at once.
+ */
+typedef struct slab_cache slab_cache;
+
+/**
+ * Creates a cache for objects of object_size bytes.
+ *
+ * @param object_size
+ *    Size of every object allocated from the cache. Objects are 8-byte
+ *    aligned.
+ *
+ * @return
+ *    A new cache, or NULL if object_size is 0, does not leave room for at
+ *    least one object per slab, or memory could not be allocated.
+ */
+slab_cache *slab_cache_create(size_t object_size);
+
+/**
+ * Allocates one object from the cache. Its contents are indeterminate.
+ *
+ * @return
+ *    A pointer to the object, or NULL if the cache needed a new slab and
+ *    memory could not be allocated.
+ */
+void *slab_alloc(slab_cache *cache);
+
+/**
+ * Returns an object previously allocated from the same cache. Passing NULL
+ * does nothing.
+ */
+void slab_free(slab_cache *cache, void *object);
+
+/**
+ * Destroys the cache and all of its slabs. Objects still allocated from it
+ * become invalid.
+ */
+void slab_cache_destroy(slab_cache *cache);
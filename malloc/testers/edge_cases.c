@@ -0,0 +1,96 @@
+/**
+* Malloc Lab
+* CS 241 - Fall 2018
+*/
+
+/**
+ * Edge case tester.
+ *
+ * Checks the corners of the allocator's interface that the benchmarks never
+ * reach, printing one line per failed check. Exits with 1 if any check
+ * failed.
+ *
+ * Compile:
+ * 	gcc -O2 -pthread edge_cases.c ../alloc.c -o edge_cases
+ */
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                           \
+    do {                                                                      \
+        if (!(cond)) {                                                        \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,  \
+                    #cond);                                                   \
+            failures++;                                                       \
+        }                                                                     \
+    } while (0)
+
+/**
+ * A small block freed twice lands in the thread cache once, so it is handed
+ * out to one caller only.
+ */
+static void double_free(void) {
+    for (size_t size = 8; size <= 1024; size *= 2) {
+        // volatile, or gcc sees through the double free and warns
+        char *volatile ptr = malloc(size);
+        CHECK(ptr != NULL);
+        free(ptr);
+        free(ptr);
+        char *a = malloc(size);
+        char *b = malloc(size);
+        CHECK(a != NULL && b != NULL && a != b);
+        free(a);
+        free(b);
+    }
+}
+
+/**
+ * posix_memalign() rejects alignments that are not a power of two multiple
+ * of sizeof(void *), zero included, and leaves *memptr alone when it does.
+ */
+static void posix_memalign_alignments(void) {
+    size_t bad[] = {0, 1, 2, sizeof(void *) / 2, 3 * sizeof(void *), 24, 100};
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+        void *ptr = &failures;
+        CHECK(posix_memalign(&ptr, bad[i], 16) == EINVAL);
+        CHECK(ptr == &failures);
+    }
+    for (size_t alignment = sizeof(void *); alignment <= 65536; alignment *= 2) {
+        void *ptr = NULL;
+        CHECK(posix_memalign(&ptr, alignment, 16) == 0);
+        CHECK(ptr != NULL && (uintptr_t)ptr % alignment == 0);
+        free(ptr);
+    }
+}
+
+/**
+ * Aligned allocations too large to ever succeed fail, rather than wrapping
+ * around to a small block.
+ */
+static void huge_aligned_allocations(void) {
+    // volatile, or gcc warns about the sizes
+    volatile size_t huge[] = {SIZE_MAX - 4000, SIZE_MAX - 100, (size_t)-40};
+    void *ptr = &failures;
+    CHECK(posix_memalign(&ptr, 4096, huge[0]) == ENOMEM);
+    CHECK(ptr == &failures);
+    errno = 0;
+    CHECK(aligned_alloc(4096, huge[1]) == NULL && errno == ENOMEM);
+    errno = 0;
+    CHECK(memalign(64, huge[2]) == NULL && errno == ENOMEM);
+}
+
+int main(void) {
+    double_free();
+    posix_memalign_alignments();
+    huge_aligned_allocations();
+    if (failures == 0)
+        printf("all checks passed\n");
+    return failures != 0;
+}
@@ -0,0 +1,77 @@
+/**
+* Malloc Lab
+* CS 241 - Fall 2018
+*/
+
+/**
+ * Multi-threaded allocation stress benchmark.
+ *
+ * Every thread keeps a private array of live allocations and repeatedly
+ * replaces a random slot with a new block of a random small size, so the run
+ * is dominated by malloc/free of the thread-cached size classes. Throughput
+ * is reported for 1, 2, 4 and 8 threads.
+ *
+ * Compile:
+ * 	gcc -O2 -pthread thread_stress.c ../alloc.c -o thread_stress
+ * 	gcc -O2 -pthread thread_stress.c -o thread_stress-glibc
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NUM_SLOTS 1024
+#define OPS_PER_THREAD 2000000
+#define MAX_SIZE 256
+
+static void *worker(void *arg) {
+    unsigned int seed = (unsigned int)(size_t)arg;
+    void *slots[NUM_SLOTS];
+    memset(slots, 0, sizeof(slots));
+    for (int i = 0; i < OPS_PER_THREAD; ++i) {
+        int slot = rand_r(&seed) % NUM_SLOTS;
+        free(slots[slot]);
+        size_t size = 1 + rand_r(&seed) % MAX_SIZE;
+        slots[slot] = malloc(size);
+        if (slots[slot] == NULL) {
+            fprintf(stderr, "malloc(%zu) failed\n", size);
+            exit(1);
+        }
+        // touch the block so the benchmark sees the cache behaviour as well
+        *(char *)slots[slot] = (char)i;
+    }
+    for (int i = 0; i < NUM_SLOTS; ++i)
+        free(slots[i]);
+    return NULL;
+}
+
+static double run(int num_threads) {
+    pthread_t threads[num_threads];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < num_threads; ++i) {
+        if (pthread_create(&threads[i], NULL, worker, (void *)(size_t)(i + 1)) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < num_threads; ++i)
+        pthread_join(threads[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+int main() {
+    int thread_counts[] = {1, 2, 4, 8};
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(int); ++i) {
+        int num_threads = thread_counts[i];
+        double elapsed = run(num_threads);
+        // one malloc and one free per iteration
+        double ops = 2.0 * OPS_PER_THREAD * num_threads;
+        printf("%d thread(s): %.0f ops/sec (%.3f s)\n", num_threads,
+               ops / elapsed, elapsed);
+    }
+    return 0;
+}
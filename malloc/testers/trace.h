@@ -0,0 +1,44 @@
+/**
+* Malloc Lab
+* CS 241 - Fall 2018
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Binary allocation trace format shared by trace_record.c and
+ * trace_replay.c.
+ *
+ * A trace file is a trace_header followed by trace_events in the order the
+ * calls returned. Blocks are identified by small integer ids instead of
+ * addresses: every successful allocation gets the next id, and free/realloc
+ * refer to the id of the block they were given. Id 0 stands for NULL (or a
+ * pointer the recorder never saw being allocated).
+ */
+
+#define TRACE_MAGIC 0x45434152544c4c41ULL // "ALLTRACE"
+
+enum trace_op { TRACE_MALLOC, TRACE_CALLOC, TRACE_REALLOC, TRACE_FREE };
+
+typedef struct trace_header {
+    uint64_t magic;
+    // number of events in the file
+    uint64_t num_events;
+    // highest block id used, so a replayer can size its tables up front
+    uint32_t max_id;
+    uint32_t unused;
+} trace_header;
+
+typedef struct __attribute__((packed)) trace_event {
+    // nanoseconds since the first recorded call
+    uint64_t time_ns;
+    // requested size, num * size for calloc, 0 for free
+    uint64_t size;
+    // block returned by malloc/calloc/realloc, or the block given to free
+    uint32_t id;
+    // block given to realloc
+    uint32_t old_id;
+    uint8_t op;
+} trace_event;
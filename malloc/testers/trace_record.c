@@ -0,0 +1,301 @@
+/**
+* Malloc Lab
+* CS 241 - Fall 2018
+*/
+
+/**
+ * LD_PRELOAD shim that records every malloc, calloc, realloc and free of a
+ * process to a binary trace (see trace.h) and forwards the call to the real
+ * allocator. The trace is written to the file named by ALLOC_TRACE, or
+ * malloc.trace by default. Aligned allocations are recorded as plain
+ * mallocs. Only the parent process is recorded, not its fork()ed children.
+ *
+ * Compile and use:
+ * 	gcc -O2 -shared -fPIC -pthread trace_record.c -o trace_record.so -ldl
+ * 	ALLOC_TRACE=app.trace LD_PRELOAD=./trace_record.so ./app
+ */
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define BUFFER_EVENTS 4096
+#define BOOTSTRAP_SIZE (64 << 10)
+
+typedef struct id_slot {
+    void *address;
+    uint32_t id;
+} id_slot;
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+static void *(*real_memalign)(size_t, size_t);
+
+// dlsym allocates, so calls made while looking up the real functions are
+// served from here and never freed
+static char bootstrap[BOOTSTRAP_SIZE];
+static size_t bootstrap_used = 0;
+static int resolving = 0;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static int trace_fd = -1;
+static int recording = 1;
+static trace_header header;
+static trace_event buffer[BUFFER_EVENTS];
+static size_t buffered = 0;
+static struct timespec start_time;
+
+// address -> id table, linear probing, allocated with mmap so it never calls
+// back into malloc
+static id_slot *ids = NULL;
+static size_t ids_capacity = 0;
+static size_t ids_used = 0;
+
+// set while the recorder itself runs, so calls it makes are not recorded
+static __thread int in_recorder = 0;
+
+static int in_bootstrap(void *ptr) {
+    return (char *)ptr >= bootstrap && (char *)ptr < bootstrap + BOOTSTRAP_SIZE;
+}
+
+static void *bootstrap_alloc(size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    if (bootstrap_used + size > BOOTSTRAP_SIZE)
+        return NULL;
+    void *ptr = bootstrap + bootstrap_used;
+    bootstrap_used += size;
+    return ptr;
+}
+
+static void stop_recording_in_child(void) {
+    recording = 0;
+    trace_fd = -1;
+    buffered = 0;
+}
+
+static void resolve(void) {
+    if (real_malloc != NULL || resolving)
+        return;
+    resolving = 1;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    real_memalign = dlsym(RTLD_NEXT, "memalign");
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    pthread_atfork(NULL, NULL, stop_recording_in_child);
+    resolving = 0;
+}
+
+static size_t slot_of(void *address) {
+    uintptr_t hash = (uintptr_t)address >> 4;
+    hash *= 0x9e3779b97f4a7c15ULL;
+    return hash & (ids_capacity - 1);
+}
+
+static void ids_insert(void *address, uint32_t id);
+
+static int ids_grow(void) {
+    size_t old_capacity = ids_capacity;
+    id_slot *old_ids = ids;
+    size_t capacity = old_capacity ? 2 * old_capacity : (1 << 16);
+    id_slot *table = mmap(NULL, capacity * sizeof(id_slot),
+                          PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                          -1, 0);
+    if (table == MAP_FAILED)
+        return 0;
+    ids = table;
+    ids_capacity = capacity;
+    ids_used = 0;
+    for (size_t i = 0; i < old_capacity; ++i)
+        if (old_ids[i].address != NULL)
+            ids_insert(old_ids[i].address, old_ids[i].id);
+    if (old_ids != NULL)
+        munmap(old_ids, old_capacity * sizeof(id_slot));
+    return 1;
+}
+
+static void ids_insert(void *address, uint32_t id) {
+    if (2 * (ids_used + 1) > ids_capacity && !ids_grow())
+        return;
+    size_t i = slot_of(address);
+    while (ids[i].address != NULL && ids[i].address != address)
+        i = (i + 1) & (ids_capacity - 1);
+    if (ids[i].address == NULL)
+        ids_used++;
+    ids[i] = (id_slot){address, id};
+}
+
+/**
+ * Remove address from the table and return its id, or 0 if it is unknown.
+ */
+static uint32_t ids_remove(void *address) {
+    if (ids_capacity == 0 || address == NULL)
+        return 0;
+    size_t i = slot_of(address);
+    while (ids[i].address != address) {
+        if (ids[i].address == NULL)
+            return 0;
+        i = (i + 1) & (ids_capacity - 1);
+    }
+    uint32_t id = ids[i].id;
+    // shift later entries of the probe sequence back into the hole
+    size_t hole = i;
+    for (size_t j = (i + 1) & (ids_capacity - 1); ids[j].address != NULL;
+         j = (j + 1) & (ids_capacity - 1)) {
+        size_t home = slot_of(ids[j].address);
+        if (((j - home) & (ids_capacity - 1)) >= ((j - hole) & (ids_capacity - 1))) {
+            ids[hole] = ids[j];
+            hole = j;
+        }
+    }
+    ids[hole] = (id_slot){NULL, 0};
+    ids_used--;
+    return id;
+}
+
+static void flush_events(void) {
+    if (trace_fd == -1 || buffered == 0)
+        return;
+    char *data = (char *)buffer;
+    size_t remaining = buffered * sizeof(trace_event);
+    while (remaining > 0) {
+        ssize_t written = write(trace_fd, data, remaining);
+        if (written <= 0)
+            break;
+        data += written;
+        remaining -= written;
+    }
+    buffered = 0;
+}
+
+static void record(uint8_t op, size_t size, void *result, void *old) {
+    if (in_recorder || !recording)
+        return;
+    in_recorder = 1;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd == -1 && recording) {
+        const char *path = getenv("ALLOC_TRACE");
+        trace_fd = open(path ? path : "malloc.trace",
+                        O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        // the header is rewritten with the final counts at exit
+        if (trace_fd != -1)
+            write(trace_fd, &header, sizeof(header));
+        else
+            recording = 0;
+    }
+    if (recording) {
+        trace_event *event = &buffer[buffered++];
+        event->time_ns = (now.tv_sec - start_time.tv_sec) * 1000000000ULL +
+                         now.tv_nsec - start_time.tv_nsec;
+        event->size = size;
+        event->op = op;
+        // remove before insert: realloc may return the same address
+        event->old_id = old ? ids_remove(old) : 0;
+        event->id = 0;
+        if (op == TRACE_FREE) {
+            event->id = event->old_id;
+            event->old_id = 0;
+        } else if (result != NULL) {
+            event->id = ++header.max_id;
+            ids_insert(result, event->id);
+        }
+        header.num_events++;
+        if (buffered == BUFFER_EVENTS)
+            flush_events();
+    }
+    pthread_mutex_unlock(&trace_lock);
+    in_recorder = 0;
+}
+
+__attribute__((destructor)) static void finish_trace(void) {
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd != -1) {
+        flush_events();
+        header.magic = TRACE_MAGIC;
+        pwrite(trace_fd, &header, sizeof(header), 0);
+        close(trace_fd);
+        trace_fd = -1;
+    }
+    recording = 0;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+void *malloc(size_t size) {
+    resolve();
+    if (real_malloc == NULL)
+        return bootstrap_alloc(size);
+    void *result = real_malloc(size);
+    record(TRACE_MALLOC, size, result, NULL);
+    return result;
+}
+
+void *calloc(size_t num, size_t size) {
+    resolve();
+    if (real_calloc == NULL)
+        return bootstrap_alloc(num * size); // static memory is zeroed
+    void *result = real_calloc(num, size);
+    record(TRACE_CALLOC, num * size, result, NULL);
+    return result;
+}
+
+void *realloc(void *ptr, size_t size) {
+    resolve();
+    if (in_bootstrap(ptr)) {
+        void *result = malloc(size);
+        // block sizes are not kept, but the old block ends before the end of
+        // the used part of the bootstrap buffer
+        size_t available = bootstrap + bootstrap_used - (char *)ptr;
+        if (result != NULL)
+            memcpy(result, ptr, size < available ? size : available);
+        return result;
+    }
+    void *result = real_realloc(ptr, size);
+    record(TRACE_REALLOC, size, result, ptr);
+    return result;
+}
+
+void free(void *ptr) {
+    if (ptr == NULL || in_bootstrap(ptr))
+        return;
+    resolve();
+    record(TRACE_FREE, 0, NULL, ptr);
+    real_free(ptr);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    resolve();
+    int result = real_posix_memalign(memptr, alignment, size);
+    record(TRACE_MALLOC, size, result == 0 ? *memptr : NULL, NULL);
+    return result;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    resolve();
+    void *result = real_aligned_alloc(alignment, size);
+    record(TRACE_MALLOC, size, result, NULL);
+    return result;
+}
+
+void *memalign(size_t alignment, size_t size) {
+    resolve();
+    void *result = real_memalign(alignment, size);
+    record(TRACE_MALLOC, size, result, NULL);
+    return result;
+}
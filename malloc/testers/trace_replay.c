@@ -0,0 +1,148 @@
+/**
+* Malloc Lab
+* CS 241 - Fall 2018
+*/
+
+/**
+ * Replays a trace written by trace_record.so against whichever allocator it
+ * is linked with, as fast as possible on one thread, and reports throughput,
+ * peak RSS and memory utilization (peak live bytes / peak RSS growth).
+ *
+ * Compile against alloc.c and against the system allocator:
+ * 	gcc -O2 -pthread trace_replay.c ../alloc.c -o trace_replay
+ * 	gcc -O2 -pthread trace_replay.c -o trace_replay-glibc
+ * Run:
+ * 	./trace_replay app.trace
+ * 	./trace_replay-glibc app.trace
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long current_rss_kb(void) {
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        if (fscanf(statm, "%*s %ld", &pages) != 1)
+            pages = 0;
+        fclose(statm);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/**
+ * Write one byte in every page of a block so its pages count towards RSS,
+ * as they would in the traced program.
+ */
+static void touch(char *ptr, size_t size) {
+    for (size_t i = 0; i < size; i += 4096)
+        ptr[i] = 1;
+    if (size)
+        ptr[size - 1] = 1;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <trace>\n", argv[0]);
+        return 1;
+    }
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 ||
+        (size_t)st.st_size < sizeof(trace_header)) {
+        fprintf(stderr, "%s: cannot read trace\n", argv[1]);
+        return 1;
+    }
+    char *file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    trace_header *header = (trace_header *)file;
+    if (file == MAP_FAILED || header->magic != TRACE_MAGIC ||
+        sizeof(trace_header) + header->num_events * sizeof(trace_event) >
+            (size_t)st.st_size) {
+        fprintf(stderr, "%s: not a complete allocation trace\n", argv[1]);
+        return 1;
+    }
+    trace_event *events = (trace_event *)(file + sizeof(trace_header));
+    size_t num_events = header->num_events;
+
+    // the tables and the trace itself are part of the baseline, not the heap
+    void **blocks = mmap(NULL, (header->max_id + 1) * sizeof(void *),
+                         PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    size_t *sizes = mmap(NULL, (header->max_id + 1) * sizeof(size_t),
+                         PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (blocks == MAP_FAILED || sizes == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    madvise(file, st.st_size, MADV_WILLNEED);
+    for (size_t i = 0; i < (size_t)st.st_size; i += 4096)
+        (void)*(volatile char *)(file + i);
+    long baseline_kb = current_rss_kb();
+
+    size_t live = 0, peak_live = 0;
+    double start = now();
+    for (size_t i = 0; i < num_events; ++i) {
+        trace_event *event = &events[i];
+        void *ptr = NULL;
+        switch (event->op) {
+        case TRACE_MALLOC:
+            ptr = malloc(event->size);
+            break;
+        case TRACE_CALLOC:
+            ptr = calloc(1, event->size);
+            break;
+        case TRACE_REALLOC:
+            ptr = realloc(blocks[event->old_id], event->size);
+            live -= sizes[event->old_id];
+            blocks[event->old_id] = NULL;
+            sizes[event->old_id] = 0;
+            break;
+        case TRACE_FREE:
+            free(blocks[event->id]);
+            live -= sizes[event->id];
+            blocks[event->id] = NULL;
+            sizes[event->id] = 0;
+            continue;
+        }
+        if (event->id != 0 && ptr != NULL) {
+            touch(ptr, event->size);
+            blocks[event->id] = ptr;
+            sizes[event->id] = event->size;
+            live += event->size;
+            if (live > peak_live)
+                peak_live = live;
+        } else if (ptr != NULL) {
+            // the recorded call failed but ours did not
+            free(ptr);
+        }
+    }
+    double elapsed = now() - start;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long heap_kb = usage.ru_maxrss - baseline_kb;
+    printf("%zu events in %.3f s, %.0f ops/sec\n", num_events, elapsed,
+           num_events / elapsed);
+    printf("peak RSS %ld KiB (%ld KiB above baseline), peak live %zu KiB\n",
+           usage.ru_maxrss, heap_kb, peak_live / 1024);
+    if (heap_kb > 0)
+        printf("utilization %.1f%%\n", 100.0 * peak_live / (heap_kb * 1024.0));
+    return 0;
+}
@@ -3,103 +3,198 @@
 * CS 241 - Fall 2018
 */
 
-#include <search.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "libds.h"
 
+#define INITIAL_CAPACITY 1024
+#define CHUNK_SIZE 65536
+// values are given at least this much room, so that small values (counts,
+// mostly) can be updated in place as they grow
+#define MIN_VALUE_SIZE 16
+
 typedef struct _datastore_entry_t {
-    const char *key, *value;
+    // NULL for an empty slot
+    const char *key;
+    char *value;
+    size_t hash;
+    // size of the buffer value points to
+    size_t value_size;
 } datastore_entry_t;
 
-// global function pointer, to the action we are currently executing
-// see datastore_iterate for an explanation
-static datastore_iterfun curr_action;
+typedef struct _datastore_chunk_t {
+    struct _datastore_chunk_t *next;
+    size_t used;
+    size_t size;
+    char data[];
+} datastore_chunk_t;
 
-// global arg pointer, to the arg we will pass to datastore_iterfun
-// see datastore_iterate and my_action for an explanation
-static void *curr_iter_arg;
+/** Private. FNV-1a */
+static size_t hash_key(const char *key) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *c = (const unsigned char *)key; *c; ++c) {
+        hash ^= *c;
+        hash *= 1099511628211ULL;
+    }
+    return (size_t)hash;
+}
 
-/** Private. */
-static int compare(const void *a, const void *b) {
-    return strcmp(((const datastore_entry_t *)a)->key,
-                  ((const datastore_entry_t *)b)->key);
+/**
+ * Private. Returns the slot holding key, or the empty slot where it would be
+ * inserted.
+ */
+static datastore_entry_t *find_slot(datastore_t *ds, const char *key,
+                                    size_t hash) {
+    size_t mask = ds->capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        datastore_entry_t *entry = ds->entries + i;
+        if (entry->key == NULL ||
+            (entry->hash == hash && strcmp(entry->key, key) == 0))
+            return entry;
+    }
 }
 
-/** Private. */
-static datastore_entry_t *malloc_entry_t(const char *key, const char *value) {
-    datastore_entry_t *entry =
-        (datastore_entry_t *)malloc(sizeof(datastore_entry_t));
-    entry->key = key;
-    entry->value = value;
+/** Private. Returns the entry for key, or NULL if there is none. */
+static datastore_entry_t *find_entry(datastore_t *ds, const char *key) {
+    if (ds->size == 0)
+        return NULL;
+    datastore_entry_t *entry = find_slot(ds, key, hash_key(key));
+    return entry->key ? entry : NULL;
+}
 
-    return entry;
+/** Private. Rehashes every entry into a table with new_capacity slots. */
+static int resize(datastore_t *ds, size_t new_capacity) {
+    datastore_entry_t *entries =
+        (datastore_entry_t *)calloc(new_capacity, sizeof(datastore_entry_t));
+    if (entries == NULL)
+        return 0;
+    size_t mask = new_capacity - 1;
+    for (size_t i = 0; i < ds->capacity; i++) {
+        datastore_entry_t *entry = ds->entries + i;
+        if (entry->key == NULL)
+            continue;
+        size_t j = entry->hash & mask;
+        while (entries[j].key != NULL)
+            j = (j + 1) & mask;
+        entries[j] = *entry;
+    }
+    free(ds->entries);
+    ds->entries = entries;
+    ds->capacity = new_capacity;
+    return 1;
 }
 
-/** Private. */
-static datastore_entry_t *dictionary_tfind(datastore_t *ds, const char *key) {
-    datastore_entry_t tentry = {key, NULL};
-    void *tresult = tfind((void *)&tentry, &ds->root, compare);
+/** Private. Copies key into the data store's arena. */
+static const char *arena_strdup(datastore_t *ds, const char *key) {
+    size_t length = strlen(key) + 1;
+    datastore_chunk_t *chunk = ds->chunks;
+    if (chunk == NULL || chunk->size - chunk->used < length) {
+        size_t size = length > CHUNK_SIZE ? length : CHUNK_SIZE;
+        chunk = (datastore_chunk_t *)malloc(sizeof(datastore_chunk_t) + size);
+        if (chunk == NULL)
+            return NULL;
+        chunk->used = 0;
+        chunk->size = size;
+        chunk->next = ds->chunks;
+        ds->chunks = chunk;
+    }
+    char *copy = chunk->data + chunk->used;
+    memcpy(copy, key, length);
+    chunk->used += length;
+    return copy;
+}
 
-    if (tresult == NULL)
-        return NULL;
-    else
-        return *((datastore_entry_t **)tresult);
+/**
+ * Private. Stores a copy of value in entry, reusing its buffer if the value
+ * fits.
+ */
+static int set_value(datastore_entry_t *entry, const char *value) {
+    size_t length = strlen(value) + 1;
+    if (length > entry->value_size) {
+        size_t size = length > MIN_VALUE_SIZE ? length : MIN_VALUE_SIZE;
+        char *buffer = (char *)malloc(size);
+        if (buffer == NULL)
+            return 0;
+        free(entry->value);
+        entry->value = buffer;
+        entry->value_size = size;
+    }
+    memcpy(entry->value, value, length);
+    return 1;
 }
 
-/** Private. */
-static void dictionary_tdelete(datastore_t *ds, const char *key) {
-    datastore_entry_t tentry = {key, NULL};
-    tdelete((void *)&tentry, &ds->root, compare);
+/**
+ * Private. Returns the entry for key, inserting it with an empty value
+ * buffer if it does not exist yet, or NULL if memory ran out.
+ */
+static datastore_entry_t *insert_entry(datastore_t *ds, const char *key,
+                                       int *added) {
+    // keep the table at most three quarters full
+    if (4 * (ds->size + 1) > 3 * ds->capacity &&
+        !resize(ds, ds->capacity ? 2 * ds->capacity : INITIAL_CAPACITY))
+        return NULL;
+    size_t hash = hash_key(key);
+    datastore_entry_t *entry = find_slot(ds, key, hash);
+    *added = entry->key == NULL;
+    if (entry->key != NULL)
+        return entry;
+
+    entry->key = arena_strdup(ds, key);
+    if (entry->key == NULL)
+        return NULL;
+    entry->value = NULL;
+    entry->hash = hash;
+    entry->value_size = 0;
+    ds->size++;
+    return entry;
 }
 
 /** Private. */
-static void destroy_with_element_free(void *ptr) {
-    datastore_entry_t *entry = (datastore_entry_t *)ptr;
-
-    free((void *)entry->key);
-    free((void *)entry->value);
-    free(entry);
-}
-
-/** private */
-static void my_action(const void *node, VISIT v,
-                      int depth __attribute__((unused))) {
-    datastore_entry_t **node_prt = (datastore_entry_t **)node;
-    datastore_entry_t *n = *node_prt;
-
-    switch (v) {
-    case preorder:
-        break;
-    case postorder:
-        curr_action(n->key, n->value, curr_iter_arg);
-        break;
-    case endorder:
-        break;
-    case leaf:
-        curr_action(n->key, n->value, curr_iter_arg);
-        break;
-    }
+static int compare(const void *a, const void *b) {
+    return strcmp((*(datastore_entry_t *const *)a)->key,
+                  (*(datastore_entry_t *const *)b)->key);
 }
 
 void datastore_init(datastore_t *ds) {
-    ds->root = NULL;
+    ds->entries = NULL;
+    ds->capacity = 0;
+    ds->size = 0;
+    ds->chunks = NULL;
 }
 
 int datastore_put(datastore_t *ds, const char *key, const char *value) {
-    if (dictionary_tfind(ds, key) == NULL) {
-        datastore_entry_t *entry = malloc_entry_t(strdup(key), strdup(value));
-        tsearch((void *)entry, &ds->root, compare);
+    int added;
+    datastore_entry_t *entry = insert_entry(ds, key, &added);
+    if (entry == NULL || !added)
+        return 0;
+    if (!set_value(entry, value)) {
+        // drop the key again
+        datastore_delete(ds, key);
+        return 0;
+    }
+    return 1;
+}
 
-        return 1;
+void *datastore_emplace(datastore_t *ds, const char *key, size_t size,
+                        int *added) {
+    datastore_entry_t *entry = insert_entry(ds, key, added);
+    if (entry == NULL || !*added)
+        return entry ? entry->value : NULL;
+    size = size > MIN_VALUE_SIZE ? size : MIN_VALUE_SIZE;
+    entry->value = (char *)calloc(1, size);
+    if (entry->value == NULL) {
+        datastore_delete(ds, key);
+        return NULL;
     }
-    return 0;
+    entry->value_size = size;
+    return entry->value;
 }
 
 const char *datastore_get(datastore_t *ds, const char *key) {
-    datastore_entry_t *entry = dictionary_tfind(ds, key);
+    datastore_entry_t *entry = find_entry(ds, key);
 
     if (entry == NULL) {
         return NULL;
@@ -109,47 +204,79 @@ const char *datastore_get(datastore_t *ds, const char *key) {
     }
 }
 
+const char *datastore_peek(datastore_t *ds, const char *key) {
+    datastore_entry_t *entry = find_entry(ds, key);
+    return entry ? entry->value : NULL;
+}
+
 int datastore_update(datastore_t *ds, const char *key, const char *value) {
-    datastore_entry_t *entry = dictionary_tfind(ds, key);
+    datastore_entry_t *entry = find_entry(ds, key);
 
     if (entry == NULL) {
         // key does not exist
         return 0;
     } else {
-        free((void *)entry->value);
-        entry->value = strdup(value);
-        return 1;
+        return set_value(entry, value);
     }
 }
 
 int datastore_delete(datastore_t *ds, const char *key) {
-    datastore_entry_t *entry = dictionary_tfind(ds, key);
+    datastore_entry_t *entry = find_entry(ds, key);
 
-    if (entry == NULL) {
+    if (entry == NULL)
         return 0;
-    } else {
-        dictionary_tdelete(ds, key);
 
-        free((void *)entry->key);
-        free((void *)entry->value);
-        free(entry);
+    // the key stays in the arena until the data store is destroyed
+    free(entry->value);
+    ds->size--;
 
-        return 1;
+    // shift back the entries of the probe run that follows, so that no
+    // lookup stops early at the slot just emptied
+    size_t mask = ds->capacity - 1;
+    size_t hole = entry - ds->entries;
+    for (size_t i = (hole + 1) & mask; ds->entries[i].key != NULL;
+         i = (i + 1) & mask) {
+        size_t home = ds->entries[i].hash & mask;
+        // move the entry unless its home slot lies cyclically in (hole, i]
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            ds->entries[hole] = ds->entries[i];
+            hole = i;
+        }
     }
+    memset(ds->entries + hole, 0, sizeof(datastore_entry_t));
+    return 1;
 }
 
 void datastore_iterate(datastore_t *ds, datastore_iterfun f, void *arg) {
-    // because twalk doesn't give us any way to pass a user defined arg into the
-    // action function, we set a global "curr_action" and call that from our
-    // action function
-    curr_action = f;
-    curr_iter_arg = arg;
-    twalk(ds->root, my_action);
-    curr_action = NULL;
-    curr_iter_arg = NULL;
+    // the table has no order of its own, so sort the entries by key first
+    datastore_entry_t **sorted =
+        (datastore_entry_t **)malloc(ds->size * sizeof(datastore_entry_t *));
+    if (sorted == NULL && ds->size > 0) {
+        fprintf(stderr, "datastore_iterate: out of memory, not sorting\n");
+        for (size_t i = 0; i < ds->capacity; i++)
+            if (ds->entries[i].key != NULL)
+                f(ds->entries[i].key, ds->entries[i].value, arg);
+        return;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < ds->capacity; i++)
+        if (ds->entries[i].key != NULL)
+            sorted[count++] = ds->entries + i;
+    qsort(sorted, count, sizeof(datastore_entry_t *), compare);
+    for (size_t i = 0; i < count; i++)
+        f(sorted[i]->key, sorted[i]->value, arg);
+    free(sorted);
 }
 
 void datastore_destroy(datastore_t *ds) {
-    tdestroy(ds->root, destroy_with_element_free);
-    ds->root = NULL;
+    for (size_t i = 0; i < ds->capacity; i++)
+        if (ds->entries[i].key != NULL)
+            free(ds->entries[i].value);
+    free(ds->entries);
+    while (ds->chunks != NULL) {
+        datastore_chunk_t *chunk = ds->chunks;
+        ds->chunks = chunk->next;
+        free(chunk);
+    }
+    datastore_init(ds);
 }
@@ -5,7 +5,22 @@
 
 #pragma once
 
-typedef struct _datastore_t { void *root; } datastore_t;
+#include <stddef.h>
+
+/**
+ * The data store is an open addressing hash table (linear probing) of
+ * entries. Keys are copied into an arena owned by the data store and live
+ * until it is destroyed; values are kept in buffers of their own which
+ * updates overwrite in place whenever the new value fits.
+ */
+typedef struct _datastore_t {
+    struct _datastore_entry_t *entries;
+    // number of slots, always a power of two
+    size_t capacity;
+    size_t size;
+    // chunks of key storage
+    struct _datastore_chunk_t *chunks;
+} datastore_t;
 
 /**
  * Initializes the data store.
@@ -36,6 +51,31 @@ void datastore_init(datastore_t *ds);
  */
 int datastore_put(datastore_t *ds, const char *key, const char *value);
 
+/**
+ * Finds the value of a specific key, adding the key with a zero filled value
+ * of 'size' bytes if it does not exist yet. This lets the user of the data
+ * store keep binary values (accumulators, say) in place of strings: the
+ * value may be read and written through the pointer returned, and is what
+ * datastore_iterate passes to its callback. Data stores holding binary
+ * values must not be used with datastore_put, datastore_get,
+ * datastore_peek or datastore_update.
+ *
+ * @param ds
+ *   An initialized data store.
+ * @param key
+ *   The key to look up or add.
+ * @param size
+ *   The size of the value, in bytes.
+ * @param added
+ *   Output: non-zero if the key was added.
+ *
+ * @return
+ *   The value, suitably aligned for any type, which stays valid until the
+ *   key is deleted or the data store is destroyed. NULL if memory ran out.
+ */
+void *datastore_emplace(datastore_t *ds, const char *key, size_t size,
+                        int *added);
+
 /**
  * Retrieves the current value, for a specific key.
  *
@@ -52,6 +92,22 @@ int datastore_put(datastore_t *ds, const char *key, const char *value);
  */
 const char *datastore_get(datastore_t *ds, const char *key);
 
+/**
+ * Retrieves the current value for a specific key, without copying it.
+ *
+ * @param ds
+ *   An initialized data store.
+ * @param key
+ *   The specific key to retrieve the value.
+ *
+ * @return
+ *   The value stored in the data store, which stays valid until the key is
+ *   next updated or deleted, or the data store is destroyed. The user of the
+ *   data store must not free or modify it. If the data store does not
+ *   contain the key, NULL will be returned.
+ */
+const char *datastore_peek(datastore_t *ds, const char *key);
+
 /**
  * Updates the specific key in the data store if and only if the
  * key exists in the data store.
@@ -90,7 +146,8 @@ int datastore_delete(datastore_t *ds, const char *key);
 
 /**
  * Iterates over the datastore, calling the callback function on each key and
- * value in the datastore.
+ * value in the datastore, in increasing order of keys (as strcmp orders
+ * them). The callback must not modify the datastore.
  *
  * @param ds
  *   An initialized datastore
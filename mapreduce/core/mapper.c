@@ -3,14 +3,272 @@
 * CS 241 - Fall 2018
 */
 
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "libds.h"
 #include "mapper.h"
 
-int run_mapper_on_fds(FILE *input, FILE *output, mapper_function func) {
+// the combiner writes out what it holds once it has this many keys
+#define COMBINER_MAX_KEYS 65536
+
+/**
+ * Collects output lines and writes them out in batches of whole lines. All
+ * the mappers of a job share each reducer's pipe, and writes of at most
+ * PIPE_BUF bytes are the ones that are not interleaved with the other
+ * mappers' writes.
+ */
+typedef struct {
+    FILE *output;
+    size_t used;
+    char buffer[PIPE_BUF];
+} line_writer;
+
+static void writer_flush(line_writer *writer) {
+    if (writer->used > 0)
+        fwrite(writer->buffer, 1, writer->used, writer->output);
+    writer->used = 0;
+    fflush(writer->output);
+}
+
+static void writer_write(line_writer *writer, const char *data, size_t length) {
+    while (length > 0) {
+        const char *newline = memchr(data, '\n', length);
+        size_t line = newline ? (size_t)(newline - data) + 1 : length;
+        if (writer->used + line > sizeof(writer->buffer))
+            writer_flush(writer);
+        if (line > sizeof(writer->buffer)) {
+            // too long to go out in one piece anyway
+            fwrite(data, 1, line, writer->output);
+            fflush(writer->output);
+        } else {
+            memcpy(writer->buffer + writer->used, data, line);
+            writer->used += line;
+        }
+        data += line;
+        length -= line;
+    }
+}
+
+/**
+ * The mapper's output, one line writer per partition of the keys.
+ */
+typedef struct {
+    size_t count;
+    line_writer *writers;
+} partitions;
+
+/**
+ * Sets up the partitions listed in the environment, or a single partition
+ * writing to output. Returns 0 on success and -1 on failure.
+ */
+static int partitions_open(partitions *parts, FILE *output) {
+    const char *fds = getenv(PARTITION_FDS_ENV);
+    parts->count = 1;
+    for (const char *c = fds; c && *c; ++c)
+        parts->count += *c == ',';
+    parts->writers = malloc(parts->count * sizeof(line_writer));
+    if (parts->writers == NULL)
+        return -1;
+    for (size_t i = 0; i < parts->count; ++i) {
+        parts->writers[i].used = 0;
+        parts->writers[i].output = NULL;
+    }
+    if (fds == NULL) {
+        parts->writers[0].output = output;
+        return 0;
+    }
+    const char *c = fds;
+    for (size_t i = 0; i < parts->count; ++i) {
+        char *end;
+        long fd = strtol(c, &end, 10);
+        if (end == c || (*end != ',' && *end != '\0'))
+            return -1;
+        c = end + 1;
+        parts->writers[i].output =
+            fd == fileno(output) ? output : fdopen((int)fd, "w");
+        if (parts->writers[i].output == NULL)
+            return -1;
+    }
+    return 0;
+}
+
+static void partitions_close(partitions *parts, FILE *output) {
+    for (size_t i = 0; i < parts->count; ++i) {
+        if (parts->writers[i].output == NULL)
+            continue;
+        writer_flush(parts->writers + i);
+        if (parts->writers[i].output != output)
+            fclose(parts->writers[i].output);
+    }
+    free(parts->writers);
+}
+
+size_t mapper_partition(const char *key, size_t length, size_t count) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash % count;
+}
+
+/** Writes output lines, each to the partition of its key. A mapper_sink. */
+static void partitions_write(void *arg, const char *data, size_t length) {
+    partitions *parts = (partitions *)arg;
+    if (parts->count == 1) {
+        writer_write(parts->writers, data, length);
+        return;
+    }
+    while (length > 0) {
+        const char *newline = memchr(data, '\n', length);
+        size_t line = newline ? (size_t)(newline - data) + 1 : length;
+        const char *split = memmem(data, line, ": ", 2);
+        size_t key = split ? (size_t)(split - data) : newline ? line - 1 : line;
+        writer_write(parts->writers + mapper_partition(data, key, parts->count),
+                     data, line);
+        data += line;
+        length -= line;
+    }
+}
+
+/**
+ * Returns whether the job's reducer, named in the environment, is the one
+ * combiner was made from: a reducer_X executable or reducer_X.so for the
+ * spec named X.
+ */
+static bool combines_for_job(const reducer_spec *combiner) {
+    const char *reducer = getenv(REDUCER_ENV);
+    if (reducer == NULL || combiner->name == NULL)
+        return false;
+    const char *slash = strrchr(reducer, '/');
+    const char *base = slash ? slash + 1 : reducer;
+    size_t prefix = strlen("reducer_"), length = strlen(combiner->name);
+    if (strncmp(base, "reducer_", prefix) != 0 ||
+        strncmp(base + prefix, combiner->name, length) != 0)
+        return false;
+    const char *suffix = base + prefix + length;
+    return *suffix == '\0' || strcmp(suffix, ".so") == 0;
+}
+
+struct mapper_context {
+    mapper_function func;
+    bool combining;
+    reducer_spec combiner;
+    datastore_t ds;
+    mapper_sink sink;
+    void *arg;
+    // the mapper function writes into this stream, from which its output is
+    // combined or handed on
+    FILE *stream;
+    char *mapped;
+    size_t mapped_size;
+};
+
+/**
+ * Hands everything the combiner holds to the sink and empties it. The pairs
+ * are printed to the mapper's stream on their way.
+ */
+static void combiner_flush(mapper_context *context) {
+    fseek(context->stream, 0, SEEK_SET);
+    reducer_write(&context->ds, &context->combiner, context->stream);
+    fflush(context->stream);
+    context->sink(context->arg, context->mapped, ftell(context->stream));
+    datastore_destroy(&context->ds);
+    datastore_init(&context->ds);
+}
+
+/**
+ * Merges the "key: value" lines in data into the combiner. Lines it cannot
+ * merge are passed through as they are, for the reducer to deal with.
+ */
+static void combine(mapper_context *context, char *data, size_t length) {
+    char *end = data + length;
+    while (data < end) {
+        char *newline = memchr(data, '\n', end - data);
+        if (newline == NULL) {
+            context->sink(context->arg, data, end - data);
+            return;
+        }
+        char *split = memmem(data, newline - data, ": ", 2);
+        int merged = 0;
+        if (split) {
+            *split = '\0';
+            *newline = '\0';
+            merged =
+                reducer_merge(&context->ds, &context->combiner, data, split + 2);
+            *split = ':';
+            *newline = '\n';
+        }
+        if (merged != 1)
+            context->sink(context->arg, data, newline + 1 - data);
+        data = newline + 1;
+    }
+}
+
+mapper_context *mapper_context_create(mapper_function func,
+                                      const reducer_spec *combiner,
+                                      mapper_sink sink, void *arg) {
+    mapper_context *context = calloc(1, sizeof(mapper_context));
+    if (context == NULL)
+        return NULL;
+    context->stream = open_memstream(&context->mapped, &context->mapped_size);
+    if (context->stream == NULL) {
+        free(context);
+        return NULL;
+    }
+    context->func = func;
+    context->combining = combiner != NULL;
+    if (combiner)
+        context->combiner = *combiner;
+    datastore_init(&context->ds);
+    context->sink = sink;
+    context->arg = arg;
+    return context;
+}
+
+void mapper_context_map(mapper_context *context, const char *line) {
+    fseek(context->stream, 0, SEEK_SET);
+    context->func(line, context->stream);
+    fflush(context->stream);
+    size_t length = ftell(context->stream);
+    if (context->combining) {
+        combine(context, context->mapped, length);
+        if (context->ds.size >= COMBINER_MAX_KEYS)
+            combiner_flush(context);
+    } else {
+        context->sink(context->arg, context->mapped, length);
+    }
+}
+
+void mapper_context_destroy(mapper_context *context) {
+    if (context->combining)
+        combiner_flush(context);
+    datastore_destroy(&context->ds);
+    fclose(context->stream);
+    free(context->mapped);
+    free(context);
+}
+
+int run_mapper_with_combiner(FILE *input, FILE *output, mapper_function func,
+                             const reducer_spec *combiner) {
+    partitions parts;
+    mapper_context *context = NULL;
+    if (combiner && !combines_for_job(combiner))
+        combiner = NULL;
+    if (partitions_open(&parts, output) == -1 ||
+        (context = mapper_context_create(func, combiner, partitions_write,
+                                         &parts)) == NULL) {
+        perror("mapper");
+        return 1;
+    }
+
     char *line = NULL;
     size_t len = 0;
     ssize_t str_len;
@@ -25,10 +283,15 @@ int run_mapper_on_fds(FILE *input, FILE *output, mapper_function func) {
                 line[--str_len] = '\0';
             }
         }
-        func(line, output);
-        fflush(output);
+        mapper_context_map(context, line);
     }
 
+    mapper_context_destroy(context);
+    partitions_close(&parts, output);
     free(line);
     return 0;
 }
+
+int run_mapper_on_fds(FILE *input, FILE *output, mapper_function func) {
+    return run_mapper_with_combiner(input, output, func, NULL);
+}
@@ -7,6 +7,22 @@
 
 #include <stdio.h>
 
+#include "reducer.h"
+
+/**
+ * When a job has several reducers, mapreduce sets this variable to the
+ * comma separated descriptors of the reducers' pipes, stdout's first, and
+ * the mapper writes each pair to the pipe of hash(key) % (number of
+ * reducers). Without it, everything goes to the output FILE*.
+ */
+#define PARTITION_FDS_ENV "MAPREDUCE_PARTITION_FDS"
+
+/**
+ * mapreduce sets this variable to the path of the job's reducer, which
+ * tells the mapper whether its combiner may stand in for it.
+ */
+#define REDUCER_ENV "MAPREDUCE_REDUCER"
+
 /**
  * type which defines a mapper function.
  * Mapper functions must take a input data string, then write their output to
@@ -20,10 +36,83 @@ typedef void (*mapper_function)(const char *, FILE *);
  */
 int run_mapper_on_fds(FILE *input, FILE *output, mapper_function func);
 
+/**
+ * runs a mapper function like run_mapper_on_fds, with a combiner: the pairs
+ * the mapper function outputs are merged by the combiner, a named reducer
+ * spec (see reducer.h), before they are written. The combiner holds a
+ * bounded number of keys, and writes them all out whenever it is full and at
+ * the end of the input, so that the reducer receives a pair per key in place
+ * of a pair per occurrence.
+ *
+ * The combiner is only used if REDUCER_ENV names the reducer it was made
+ * from; with any other reducer, or none, the mapper runs uncombined.
+ */
+int run_mapper_with_combiner(FILE *input, FILE *output, mapper_function func,
+                             const reducer_spec *combiner);
+
+/**
+ * Returns the partition, out of 'count', of the key 'key' of length
+ * 'length': the reducer it goes to when a job has several.
+ */
+size_t mapper_partition(const char *key, size_t length, size_t count);
+
+/**
+ * The mapping loop on its own, for runners which get their input lines and
+ * send the output somewhere else than FILE*s (see runner.h).
+ *
+ * The mapper function's output, combined if 'combiner' is not NULL, is
+ * handed to 'sink' in batches of whole "key: value\n" lines. It is up to
+ * the caller to only pass a combiner the job's reducer allows.
+ */
+typedef void (*mapper_sink)(void *arg, const char *lines, size_t length);
+typedef struct mapper_context mapper_context;
+
+/**
+ * Returns a new context, or NULL if memory ran out.
+ */
+mapper_context *mapper_context_create(mapper_function func,
+                                      const reducer_spec *combiner,
+                                      mapper_sink sink, void *arg);
+
+/**
+ * Runs the mapper function on one line of input, without its newline.
+ */
+void mapper_context_map(mapper_context *context, const char *line);
+
+/**
+ * Hands whatever the combiner still holds to the sink, and frees the
+ * context.
+ */
+void mapper_context_destroy(mapper_context *context);
+
+/**
+ * The mapper executables made by the macros below also export their mapper
+ * function and combiner under these names, so that mapreduce -t can run
+ * them in process when they are built as shared objects (see runner.h).
+ */
+#define MAPPER_SYMBOL "mapreduce_mapper"
+#define COMBINER_SYMBOL "mapreduce_combiner"
+extern const mapper_function mapreduce_mapper;
+extern const reducer_spec mapreduce_combiner;
+
 /**
  * macro to create a main method which only runs the mapper function.
  */
 #define MAKE_MAPPER_MAIN(func)                         \
+    const mapper_function mapreduce_mapper = func;     \
     int main() {                                       \
         return run_mapper_on_fds(stdin, stdout, func); \
     }
+
+/**
+ * macro to create a main method which runs the mapper function with a
+ * combiner, given as a reducer_spec initializer (see reducer.h):
+ * 	MAKE_COMBINING_MAPPER_MAIN(mapper, SUM_REDUCER)
+ */
+#define MAKE_COMBINING_MAPPER_MAIN(func, combiner)                          \
+    const mapper_function mapreduce_mapper = func;                          \
+    const reducer_spec mapreduce_combiner = combiner;                       \
+    int main() {                                                            \
+        return run_mapper_with_combiner(stdin, stdout, func,                \
+                                        &mapreduce_combiner);               \
+    }
@@ -4,6 +4,7 @@
 */
 
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -12,20 +13,138 @@
 #include "reducer.h"
 #include "utils.h"
 
-static FILE *whereto = NULL;
+typedef union {
+    int64_t int64;
+    uint64_t uint64;
+    double dbl;
+} typed_value;
+
+typedef struct {
+    const reducer_spec *spec;
+    FILE *output;
+} write_args;
 
 void print_ds(const char *key, const char *value, void *arg) {
+    FILE *whereto = (FILE *)arg;
     assert(whereto);
     fprintf(whereto, "%s: %s\n", key, value);
-    fflush(whereto);
 }
 
-int run_reducer_on(FILE *input, FILE *output, reducer_fun func) {
+/** Prints a binary accumulator kept by a typed reducer. */
+static void print_typed(const char *key, const char *value, void *arg) {
+    write_args *args = (write_args *)arg;
+    typed_value v;
+    memcpy(&v, value, sizeof(v));
+    fprintf(args->output, "%s: ", key);
+    switch (args->spec->type) {
+    case REDUCER_INT64:
+        fprintf(args->output, args->spec->format, v.int64);
+        break;
+    case REDUCER_UINT64:
+        fprintf(args->output, args->spec->format, v.uint64);
+        break;
+    case REDUCER_DOUBLE:
+        fprintf(args->output, args->spec->format, v.dbl);
+        break;
+    case REDUCER_TEXT:
+        break;
+    }
+    fputc('\n', args->output);
+}
+
+/** Parses a value of the reducer's type, returning "boolean" success. */
+static int parse_value(const reducer_spec *spec, const char *str,
+                       typed_value *value) {
+    char *end = (char *)str;
+    errno = 0;
+    switch (spec->type) {
+    case REDUCER_INT64:
+        value->int64 = strtoll(str, &end, spec->base);
+        break;
+    case REDUCER_UINT64:
+        value->uint64 = strtoull(str, &end, spec->base);
+        break;
+    case REDUCER_DOUBLE:
+        value->dbl = strtod(str, &end);
+        break;
+    case REDUCER_TEXT:
+        break;
+    }
+    return end != str && *end == '\0' && errno == 0;
+}
+
+/** Merges a pair into a data store of text values. */
+static int merge_text(datastore_t *ds, reducer_fun func, const char *key,
+                      const char *value) {
+    // datastore_peek does not copy the string, and datastore_update
+    // writes the new value over the old one when it fits
+    const char *curr_val = datastore_peek(ds, key);
+    if (curr_val) {
+        const char *new_value = func(curr_val, value);
+        int updated = datastore_update(ds, key, new_value);
+
+        free((char *)new_value);
+        return updated ? 1 : -1;
+    } else {
+        return datastore_put(ds, key, value) ? 1 : -1;
+    }
+}
+
+int reducer_merge(datastore_t *ds, const reducer_spec *spec, const char *key,
+                  const char *value) {
+    if (spec->type == REDUCER_TEXT)
+        return merge_text(ds, spec->func.text, key, value);
+
+    typed_value parsed = {0};
+    if (!parse_value(spec, value, &parsed))
+        return 0;
+
+    // the accumulator lives in the data store and is merged in place
+    int added;
+    typed_value *acc = (typed_value *)datastore_emplace(
+        ds, key, sizeof(typed_value), &added);
+    if (acc == NULL)
+        return -1;
+    if (added) {
+        *acc = parsed;
+        return 1;
+    }
+    switch (spec->type) {
+    case REDUCER_INT64:
+        acc->int64 = spec->func.int64(acc->int64, parsed.int64);
+        break;
+    case REDUCER_UINT64:
+        acc->uint64 = spec->func.uint64(acc->uint64, parsed.uint64);
+        break;
+    case REDUCER_DOUBLE:
+        acc->dbl = spec->func.dbl(acc->dbl, parsed.dbl);
+        break;
+    case REDUCER_TEXT:
+        break;
+    }
+    return 1;
+}
+
+void reducer_write(datastore_t *ds, const reducer_spec *spec, FILE *output) {
+    if (spec->type == REDUCER_TEXT) {
+        datastore_iterate(ds, print_ds, output);
+    } else {
+        write_args args = {spec, output};
+        datastore_iterate(ds, print_typed, &args);
+    }
+}
+
+int64_t sum_int64(int64_t value1, int64_t value2) {
+    return value1 + value2;
+}
+
+int run_reducer_spec_on(FILE *input, FILE *output, const reducer_spec *spec) {
     datastore_t my_datastore;
     datastore_init(&my_datastore);
 
     char *line = NULL;
     size_t size = 0;
+    int result = 0;
 
     while (getline(&line, &size, input) != -1) {
         char *key = NULL;
@@ -36,26 +155,46 @@ int run_reducer_on(FILE *input, FILE *output, reducer_fun func) {
             continue;
         }
 
-        // datastore_get returns a copy of the string
-        const char *curr_val = datastore_get(&my_datastore, key);
-        if (curr_val) {
-            const char *new_value = func(curr_val, value);
-            datastore_update(&my_datastore, key, new_value);
-
-            free((char *)curr_val);
-            free((char *)new_value);
-        } else {
-            datastore_put(&my_datastore, key, value);
+        int merged = reducer_merge(&my_datastore, spec, key, value);
+        if (merged == 0) {
+            fprintf(stderr, "reducer input is malformed: %s: %s\n", key, value);
+        } else if (merged == -1) {
+            fprintf(stderr, "reducer ran out of memory\n");
+            result = 1;
+            break;
         }
     }
 
-    // FIXME not thread safe, but could be. lock it or use thread local storage
-    whereto = output;
-    datastore_iterate(&my_datastore, print_ds, NULL);
-    whereto = NULL;
+    if (result == 0) {
+        reducer_write(&my_datastore, spec, output);
+        fflush(output);
+    }
 
     datastore_destroy(&my_datastore);
     free(line);
 
-    return 0;
+    return result;
+}
+
+int run_reducer_on(FILE *input, FILE *output, reducer_fun func) {
+    reducer_spec spec = {REDUCER_TEXT, {.text = func}, 0, NULL, NULL};
+    return run_reducer_spec_on(input, output, &spec);
+}
+
+int run_int64_reducer_on(FILE *input, FILE *output, int64_reducer_fun func,
+                         int base, const char *format) {
+    reducer_spec spec = {REDUCER_INT64, {.int64 = func}, base, format, NULL};
+    return run_reducer_spec_on(input, output, &spec);
+}
+
+int run_uint64_reducer_on(FILE *input, FILE *output, uint64_reducer_fun func,
+                          int base, const char *format) {
+    reducer_spec spec = {REDUCER_UINT64, {.uint64 = func}, base, format, NULL};
+    return run_reducer_spec_on(input, output, &spec);
+}
+
+int run_double_reducer_on(FILE *input, FILE *output, double_reducer_fun func,
+                          const char *format) {
+    reducer_spec spec = {REDUCER_DOUBLE, {.dbl = func}, 0, format, NULL};
+    return run_reducer_spec_on(input, output, &spec);
 }
@@ -5,18 +5,135 @@
 
 #pragma once
 
+#include <inttypes.h>
+#include <stdint.h>
 #include <stdio.h>
 
+#include "libds.h"
+
 typedef const char *(*reducer_fun)(const char *, const char *);
 
 /**
  * Runs the reducer function on the input FILE *, outputting to the output FILE*
- *
- * NOT THREAD SAFE.
+ * in increasing order of keys.
  */
 int run_reducer_on(FILE *input, FILE *output, reducer_fun func);
 
-#define MAKE_REDUCER_MAIN(func)                     \
-    int main() {                                    \
-        return run_reducer_on(stdin, stdout, func); \
+/**
+ * Typed reducers.
+ *
+ * A reducer whose values are all numbers can merge them as numbers: each
+ * value is parsed once as it is read, the data store keeps the binary
+ * accumulator of every key, and the results are formatted once, on output,
+ * with 'format' (a printf format taking exactly one value of the type).
+ * Integers are parsed as strtoll/strtoull would in 'base'; values that do
+ * not parse are reported and skipped, like malformed lines.
+ */
+typedef int64_t (*int64_reducer_fun)(int64_t, int64_t);
+typedef uint64_t (*uint64_reducer_fun)(uint64_t, uint64_t);
+typedef double (*double_reducer_fun)(double, double);
+
+int run_int64_reducer_on(FILE *input, FILE *output, int64_reducer_fun func,
+                         int base, const char *format);
+int run_uint64_reducer_on(FILE *input, FILE *output, uint64_reducer_fun func,
+                          int base, const char *format);
+int run_double_reducer_on(FILE *input, FILE *output, double_reducer_fun func,
+                          const char *format);
+
+/**
+ * A reducer function of any of the kinds above, with what it needs to parse
+ * and format its values. The *_REDUCER macros initialize one:
+ * 	reducer_spec spec = INT64_REDUCER(sum, 10, "%" PRId64);
+ */
+typedef enum {
+    REDUCER_TEXT,
+    REDUCER_INT64,
+    REDUCER_UINT64,
+    REDUCER_DOUBLE
+} reducer_type;
+
+typedef struct {
+    reducer_type type;
+    union {
+        reducer_fun text;
+        int64_reducer_fun int64;
+        uint64_reducer_fun uint64;
+        double_reducer_fun dbl;
+    } func;
+    // unused by text reducers, base is for integers only
+    int base;
+    const char *format;
+    // set for the reducers mappers may combine with, see below
+    const char *name;
+} reducer_spec;
+
+#define TEXT_REDUCER(func) {REDUCER_TEXT, {.text = func}, 0, NULL, NULL}
+#define INT64_REDUCER(func, base, format) \
+    {REDUCER_INT64, {.int64 = func}, base, format, NULL}
+#define UINT64_REDUCER(func, base, format) \
+    {REDUCER_UINT64, {.uint64 = func}, base, format, NULL}
+#define DOUBLE_REDUCER(func, format) \
+    {REDUCER_DOUBLE, {.dbl = func}, 0, format, NULL}
+
+/**
+ * Reducers mappers can combine with.
+ *
+ * A mapper may merge its pairs with the job's reducer before it writes them
+ * (see run_mapper_with_combiner in mapper.h). That is only valid for a
+ * reducer whose function is associative and commutative, so that merging
+ * some of a key's values early does not change its result, and only when
+ * the job does run that reducer. Such a reducer is shared between the
+ * reducer and the mappers as a named spec below: the spec named "X" is the
+ * one reducer_X runs, and mappers only combine with it in jobs which run
+ * reducer_X.
+ */
+int64_t sum_int64(int64_t value1, int64_t value2);
+#define SUM_REDUCER \
+    {REDUCER_INT64, {.int64 = sum_int64}, 10, "%" PRId64, "sum"}
+
+/**
+ * Runs the reducer described by spec on the input FILE *, outputting to the
+ * output FILE* in increasing order of keys.
+ */
+int run_reducer_spec_on(FILE *input, FILE *output, const reducer_spec *spec);
+
+/**
+ * The reducer executables made by the macros below also export their
+ * reducer under this name, so that mapreduce -t can run them in process
+ * when they are built as shared objects (see runner.h).
+ */
+#define REDUCER_SYMBOL "mapreduce_reducer"
+extern const reducer_spec mapreduce_reducer;
+
+#define MAKE_SPEC_REDUCER_MAIN(spec)                                       \
+    const reducer_spec mapreduce_reducer = spec;                           \
+    int main() {                                                           \
+        return run_reducer_spec_on(stdin, stdout, &mapreduce_reducer);     \
     }
+
+#define MAKE_REDUCER_MAIN(func) MAKE_SPEC_REDUCER_MAIN(TEXT_REDUCER(func))
+
+#define MAKE_INT64_REDUCER_MAIN(func, base, format) \
+    MAKE_SPEC_REDUCER_MAIN(INT64_REDUCER(func, base, format))
+
+#define MAKE_UINT64_REDUCER_MAIN(func, base, format) \
+    MAKE_SPEC_REDUCER_MAIN(UINT64_REDUCER(func, base, format))
+
+#define MAKE_DOUBLE_REDUCER_MAIN(func, format) \
+    MAKE_SPEC_REDUCER_MAIN(DOUBLE_REDUCER(func, format))
+
+/**
+ * Merges the pair (key, value) into ds, a data store that only this reducer
+ * has been merging into.
+ *
+ * @return 1 on success, 0 if the value does not parse and -1 if memory ran
+ * out.
+ */
+int reducer_merge(datastore_t *ds, const reducer_spec *spec, const char *key,
+                  const char *value);
+
+/**
+ * Writes every pair merged into ds to output, in increasing order of keys,
+ * in the same "key: value" lines the reducer reads.
+ */
+void reducer_write(datastore_t *ds, const reducer_spec *spec, FILE *output);
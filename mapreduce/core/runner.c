@@ -0,0 +1,399 @@
+/**
+*  Lab
+* CS 241 - Fall 2018
+*/
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libds.h"
+#include "mapper.h"
+#include "reducer.h"
+#include "runner.h"
+#include "utils.h"
+
+// pairs are handed over in chunks of this many bytes
+#define CHUNK_SIZE 65536
+
+/**
+ * A chunk of "key\0value\0" pairs.
+ */
+typedef struct chunk {
+    struct chunk *next;
+    size_t used;
+    size_t size;
+    char data[];
+} chunk;
+
+/**
+ * The queue from one mapper thread to one reducer thread. The mapper thread
+ * fills 'filling' on its own, then publishes it by linking it after the
+ * last chunk it published (or as 'head'), and sets 'done' once it has
+ * published everything. Each chunk published and 'done' are announced by
+ * posting the reducer's semaphore once.
+ */
+typedef struct {
+    chunk *head;
+    bool done;
+    // the mapper thread's end
+    chunk *filling;
+    chunk *published;
+    // the reducer thread's end: the last chunk consumed, which is freed once
+    // its successor is published (the mapper thread writes its 'next')
+    chunk *consumed;
+    bool finished;
+} channel;
+
+typedef struct {
+    const char *data;
+    size_t length;
+    int num_mappers;
+    int num_reducers;
+    mapper_function mapper;
+    const reducer_spec *combiner;
+    const reducer_spec *reducer;
+    // channels[mapper * num_reducers + reducer]
+    channel *channels;
+    // one per reducer
+    sem_t *ready;
+    // the sorted output of each reducer
+    char **outputs;
+    size_t *output_sizes;
+    bool failed;
+} job;
+
+typedef struct {
+    job *job;
+    int index;
+} worker;
+
+static void publish(job *j, channel *c, int reducer) {
+    chunk *full = c->filling;
+    c->filling = NULL;
+    full->next = NULL;
+    __atomic_store_n(c->published ? &c->published->next : &c->head, full,
+                     __ATOMIC_RELEASE);
+    c->published = full;
+    sem_post(j->ready + reducer);
+}
+
+/**
+ * Appends the pair (key, value) to the mapper thread's queue to 'reducer'.
+ */
+static void push_pair(job *j, channel *c, int reducer, const char *key,
+                      size_t key_length, const char *value,
+                      size_t value_length) {
+    size_t length = key_length + value_length + 2;
+    if (c->filling && c->filling->size - c->filling->used < length)
+        publish(j, c, reducer);
+    if (c->filling == NULL) {
+        size_t size = length > CHUNK_SIZE ? length : CHUNK_SIZE;
+        c->filling = malloc(sizeof(chunk) + size);
+        if (c->filling == NULL) {
+            fprintf(stderr, "mapper ran out of memory\n");
+            exit(1);
+        }
+        c->filling->used = 0;
+        c->filling->size = size;
+    }
+    char *end = c->filling->data + c->filling->used;
+    memcpy(end, key, key_length);
+    end[key_length] = '\0';
+    memcpy(end + key_length + 1, value, value_length);
+    end[length - 1] = '\0';
+    c->filling->used += length;
+}
+
+/**
+ * The mapper threads' mapper_sink: splits "key: value" lines and queues
+ * each pair for the reducer of its key.
+ */
+static void queue_lines(void *arg, const char *data, size_t length) {
+    worker *w = (worker *)arg;
+    job *j = w->job;
+    channel *channels = j->channels + (size_t)w->index * j->num_reducers;
+    while (length > 0) {
+        const char *newline = memchr(data, '\n', length);
+        size_t line = newline ? (size_t)(newline - data) : length;
+        const char *split = memmem(data, line, ": ", 2);
+        if (split == NULL) {
+            fprintf(stderr, "reducer input is malformed: %.*s\n", (int)line,
+                    data);
+        } else {
+            size_t key = split - data;
+            int reducer = (int)mapper_partition(data, key, j->num_reducers);
+            push_pair(j, channels + reducer, reducer, data, key, split + 2,
+                      line - key - 2);
+        }
+        line += newline != NULL;
+        data += line;
+        length -= line;
+    }
+}
+
+/**
+ * Returns the start of the next line after p, as splitter.c does.
+ */
+static const char *next_line(const char *p, const char *end) {
+    const char *newline = memchr(p, '\n', end - p);
+    return newline ? newline + 1 : end;
+}
+
+static void *run_mapper(void *arg) {
+    worker *w = (worker *)arg;
+    job *j = w->job;
+    // split the input as splitter does
+    const char *end = j->data + j->length;
+    const char *start =
+        w->index == 0
+            ? j->data
+            : next_line(j->data + j->length * w->index / j->num_mappers, end);
+    const char *stop =
+        w->index == j->num_mappers - 1
+            ? end
+            : next_line(j->data + j->length * (w->index + 1) / j->num_mappers,
+                        end);
+
+    mapper_context *context =
+        mapper_context_create(j->mapper, j->combiner, queue_lines, w);
+    if (context == NULL) {
+        fprintf(stderr, "mapper ran out of memory\n");
+        exit(1);
+    }
+    // the input is read only, so each line is copied to be NUL terminated
+    char *line = NULL;
+    size_t capacity = 0;
+    while (start < stop) {
+        const char *newline = memchr(start, '\n', stop - start);
+        size_t length = newline ? (size_t)(newline - start) : (size_t)(stop - start);
+        if (length + 1 > capacity) {
+            capacity = 2 * (length + 1);
+            free(line);
+            line = malloc(capacity);
+            if (line == NULL) {
+                fprintf(stderr, "mapper ran out of memory\n");
+                exit(1);
+            }
+        }
+        memcpy(line, start, length);
+        line[length] = '\0';
+        // and carriage return
+        if (length > 0 && line[length - 1] == '\r')
+            line[length - 1] = '\0';
+        mapper_context_map(context, line);
+        start += length + (newline != NULL);
+    }
+    mapper_context_destroy(context);
+    free(line);
+
+    channel *channels = j->channels + (size_t)w->index * j->num_reducers;
+    for (int r = 0; r < j->num_reducers; ++r) {
+        if (channels[r].filling)
+            publish(j, channels + r, r);
+        __atomic_store_n(&channels[r].done, true, __ATOMIC_RELEASE);
+        sem_post(j->ready + r);
+    }
+    return NULL;
+}
+
+/**
+ * Handles one announcement from the mapper threads: a chunk to consume or a
+ * mapper thread that is done. Returns "boolean" whether it was the latter.
+ */
+static int consume(job *j, int reducer, datastore_t *ds, bool *failed) {
+    while (true) {
+        for (int m = 0; m < j->num_mappers; ++m) {
+            channel *c = j->channels + (size_t)m * j->num_reducers + reducer;
+            if (c->finished)
+                continue;
+            chunk **link = c->consumed ? &c->consumed->next : &c->head;
+            chunk *next = __atomic_load_n(link, __ATOMIC_ACQUIRE);
+            if (next == NULL) {
+                if (!__atomic_load_n(&c->done, __ATOMIC_ACQUIRE))
+                    continue;
+                // the last chunk may have been published between the two
+                // loads, but as it is published before 'done' is set, it is
+                // seen now if it exists
+                next = __atomic_load_n(link, __ATOMIC_ACQUIRE);
+                if (next == NULL) {
+                    free(c->consumed);
+                    c->consumed = NULL;
+                    c->finished = true;
+                    return 1;
+                }
+            }
+            for (char *pair = next->data; pair < next->data + next->used;) {
+                char *value = pair + strlen(pair) + 1;
+                // after running out of memory, the chunks are only drained
+                int merged =
+                    *failed ? 1 : reducer_merge(ds, j->reducer, pair, value);
+                if (merged == 0) {
+                    fprintf(stderr, "reducer input is malformed: %s: %s\n",
+                            pair, value);
+                } else if (merged == -1) {
+                    fprintf(stderr, "reducer ran out of memory\n");
+                    *failed = true;
+                    __atomic_store_n(&j->failed, true, __ATOMIC_RELAXED);
+                }
+                pair = value + strlen(value) + 1;
+            }
+            free(c->consumed);
+            c->consumed = next;
+            return 0;
+        }
+    }
+}
+
+static void *run_reducer(void *arg) {
+    worker *w = (worker *)arg;
+    job *j = w->job;
+    datastore_t ds;
+    datastore_init(&ds);
+    bool failed = false;
+    for (int done = 0; done < j->num_mappers;) {
+        sem_wait(j->ready + w->index);
+        done += consume(j, w->index, &ds, &failed);
+    }
+    FILE *output = open_memstream(j->outputs + w->index, j->output_sizes + w->index);
+    if (output == NULL) {
+        perror("reducer");
+        exit(1);
+    }
+    reducer_write(&ds, j->reducer, output);
+    fclose(output);
+    datastore_destroy(&ds);
+    return NULL;
+}
+
+/**
+ * Loads the shared object 'path' and returns the address of 'symbol' in it,
+ * or NULL if it is not there.
+ */
+static void *load_symbol(const char *path, const char *symbol, bool required) {
+    // dlopen looks for names without a slash on the library path
+    char relative[strlen(path) + 3];
+    if (strchr(path, '/') == NULL) {
+        sprintf(relative, "./%s", path);
+        path = relative;
+    }
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        fprintf(stderr, "%s\n", dlerror());
+        return NULL;
+    }
+    void *address = dlsym(handle, symbol);
+    if (address == NULL && required)
+        fprintf(stderr, "%s: no %s, was it made with a MAKE_*_MAIN macro?\n",
+                path, symbol);
+    return address;
+}
+
+int run_in_process(const char *input_file, const char *output_file,
+                   const char *mapper_lib, const char *reducer_lib,
+                   int num_mappers, int num_reducers) {
+    job j = {0};
+    j.num_mappers = num_mappers;
+    j.num_reducers = num_reducers;
+    const mapper_function *mapper =
+        load_symbol(mapper_lib, MAPPER_SYMBOL, true);
+    j.reducer = load_symbol(reducer_lib, REDUCER_SYMBOL, true);
+    if (mapper == NULL || j.reducer == NULL)
+        return 1;
+    j.mapper = *mapper;
+    j.combiner = load_symbol(mapper_lib, COMBINER_SYMBOL, false);
+    // only combine with the reducer the combiner was made from
+    if (j.combiner && (j.combiner->name == NULL || j.reducer->name == NULL ||
+                       strcmp(j.combiner->name, j.reducer->name) != 0))
+        j.combiner = NULL;
+
+    int fd = open(input_file, O_RDONLY);
+    struct stat s;
+    if (fd == -1 || fstat(fd, &s) == -1) {
+        perror(input_file);
+        return 1;
+    }
+    j.length = s.st_size;
+    j.data = "";
+    if (j.length > 0) {
+        j.data = mmap(NULL, j.length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (j.data == MAP_FAILED) {
+            perror(input_file);
+            return 1;
+        }
+        madvise((void *)j.data, j.length, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    j.channels = calloc((size_t)num_mappers * num_reducers, sizeof(channel));
+    j.ready = calloc(num_reducers, sizeof(sem_t));
+    j.outputs = calloc(num_reducers, sizeof(char *));
+    j.output_sizes = calloc(num_reducers, sizeof(size_t));
+    worker *workers = calloc(num_mappers + num_reducers, sizeof(worker));
+    pthread_t *threads = calloc(num_mappers + num_reducers, sizeof(pthread_t));
+    if (!j.channels || !j.ready || !j.outputs || !j.output_sizes || !workers ||
+        !threads) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (int r = 0; r < num_reducers; ++r)
+        sem_init(j.ready + r, 0, 0);
+
+    for (int i = 0; i < num_mappers + num_reducers; ++i) {
+        workers[i].job = &j;
+        workers[i].index = i < num_reducers ? i : i - num_reducers;
+        if (pthread_create(threads + i, NULL,
+                           i < num_reducers ? run_reducer : run_mapper,
+                           workers + i) != 0) {
+            fprintf(stderr, "could not start threads\n");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < num_mappers + num_reducers; ++i)
+        pthread_join(threads[i], NULL);
+
+    int result = j.failed ? 1 : 0;
+    FILE *output = fopen(output_file, "w+");
+    // fmemopen wants a buffer that is not empty
+    FILE *inputs[num_reducers];
+    int num_inputs = 0;
+    for (int r = 0; r < num_reducers; ++r) {
+        if (j.output_sizes[r] > 0 &&
+            (inputs[num_inputs] = fmemopen(j.outputs[r], j.output_sizes[r], "r")))
+            num_inputs++;
+    }
+    if (result == 0 && output == NULL) {
+        perror(output_file);
+        result = 1;
+    } else if (result == 0 &&
+               merge_sorted_outputs(inputs, num_inputs, output) == -1) {
+        perror(output_file);
+        result = 1;
+    }
+    if (output)
+        fclose(output);
+    for (int i = 0; i < num_inputs; ++i)
+        fclose(inputs[i]);
+    for (int r = 0; r < num_reducers; ++r) {
+        free(j.outputs[r]);
+        sem_destroy(j.ready + r);
+    }
+
+    if (j.length > 0)
+        munmap((void *)j.data, j.length);
+    free(j.channels);
+    free(j.ready);
+    free(j.outputs);
+    free(j.output_sizes);
+    free(workers);
+    free(threads);
+    return result;
+}
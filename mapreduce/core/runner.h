@@ -0,0 +1,31 @@
+/**
+*  Lab
+* CS 241 - Fall 2018
+*/
+
+#pragma once
+
+/**
+ * In process runner (mapreduce -t).
+ *
+ * Runs a whole job in one process: the mapper and the reducer are loaded
+ * from shared objects (mapper_*.so and reducer_*.so, built from the same
+ * sources as the executables, which export their functions, see mapper.h
+ * and reducer.h), and run on num_mappers and num_reducers threads.
+ *
+ * The input file is mapped into memory and split between the mapper threads
+ * the way splitter splits it. Each mapper thread hands the pairs it outputs
+ * (combined, if the mapper has a combiner) to the reducer thread of their
+ * key's partition through a queue of its own, which only that mapper thread
+ * appends to and only that reducer thread consumes, so no lock is taken on
+ * the way. The reducers' outputs are merged by key into output_file, as
+ * with several reducer processes.
+ *
+ * Mapper and reducer functions run concurrently on several threads and must
+ * be thread safe.
+ *
+ * Returns 0 on success and 1 on failure, after printing why.
+ */
+int run_in_process(const char *input_file, const char *output_file,
+                   const char *mapper_lib, const char *reducer_lib,
+                   int num_mappers, int num_reducers);
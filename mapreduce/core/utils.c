@@ -22,7 +22,9 @@ static int descriptors_array_capacity;
 
 void print_usage() {
     printf("./mapreduce input_file output_file mapper_exec reducer_exec "
-           "num_mappers\n");
+           "num_mappers [num_reducers]\n"
+           "./mapreduce -t input_file output_file mapper_lib reducer_lib "
+           "num_mappers [num_reducers]\n");
 }
 
 void print_nonzero_exit_status(char *exec_name, int exit_status) {
@@ -89,3 +91,56 @@ int split_key_value(char *line, char **key, char **value) {
 
     return 1; // true
 }
+
+/**
+ * Returns the length of the key of the output line 'line', everything up to
+ * the first ": ", as split_key_value sees it.
+ */
+static size_t key_length(const char *line) {
+    const char *split = strstr(line, ": ");
+    return split ? (size_t)(split - line) : strcspn(line, "\n");
+}
+
+int merge_sorted_outputs(FILE **inputs, int count, FILE *output) {
+    char *lines[count];
+    size_t sizes[count];
+    size_t keys[count];
+    int result = 0;
+    for (int i = 0; i < count; ++i) {
+        lines[i] = NULL;
+        sizes[i] = 0;
+        if (getline(&lines[i], &sizes[i], inputs[i]) == -1) {
+            free(lines[i]);
+            lines[i] = NULL;
+        } else {
+            keys[i] = key_length(lines[i]);
+        }
+    }
+    while (1) {
+        int next = -1;
+        for (int i = 0; i < count; ++i) {
+            if (lines[i] == NULL)
+                continue;
+            if (next == -1) {
+                next = i;
+                continue;
+            }
+            // compare the keys as strcmp would
+            size_t length = keys[i] < keys[next] ? keys[i] : keys[next];
+            int cmp = memcmp(lines[i], lines[next], length);
+            if (cmp < 0 || (cmp == 0 && keys[i] < keys[next]))
+                next = i;
+        }
+        if (next == -1)
+            break;
+        if (fputs(lines[next], output) == EOF)
+            result = -1;
+        if (getline(&lines[next], &sizes[next], inputs[next]) == -1) {
+            free(lines[next]);
+            lines[next] = NULL;
+        } else {
+            keys[next] = key_length(lines[next]);
+        }
+    }
+    return fflush(output) == EOF ? -1 : result;
+}
@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include <stdio.h>
 #include <sys/types.h>
 
 /**
@@ -53,3 +54,15 @@ void descriptors_destroy();
  * @return "boolean" representing success or failure
  */
 int split_key_value(char *line, char **key, char **value);
+
+/**
+ * Merges reducer outputs, each sorted by key and with keys no other output
+ * has, into one output sorted by key.
+ *
+ * @param inputs - the outputs to merge, read to their end
+ * @param count - number of inputs
+ * @param output - where to write the merged lines
+ *
+ * @return 0 on success, -1 if writing the output failed
+ */
+int merge_sorted_outputs(FILE **inputs, int count, FILE *output);
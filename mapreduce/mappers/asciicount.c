@@ -21,4 +21,4 @@ void mapper(const char *data, FILE *output) {
     }
 }
 
-MAKE_MAPPER_MAIN(mapper)
+MAKE_COMBINING_MAPPER_MAIN(mapper, SUM_REDUCER)
@@ -14,7 +14,7 @@ void replace_chars(char *str) {
     while (*str) {
         if (*str == ':')
             *str = ';';
-        // prevent newline from messing up with strtok()
+        // prevent newline from messing up with strtok_r()
         if (*str == '\n')
             *str = ' ';
         str++;
@@ -25,14 +25,16 @@ void mapper(const char *data, FILE *output) {
     char *data_copy = strdup(data);
     if (data_copy)
         replace_chars(data_copy);
-    char *datum = strtok(data_copy, " ");
+    // strtok_r, as mappers may run on several threads at once
+    char *saveptr = NULL;
+    char *datum = strtok_r(data_copy, " ", &saveptr);
     while (datum) {
         // the difference is just a few pixels :-)
         fprintf(output, "%s: 1\n", datum);
-        datum = strtok(NULL, " ");
+        datum = strtok_r(NULL, " ", &saveptr);
     }
 
     free(data_copy);
 }
 
-MAKE_MAPPER_MAIN(mapper)
+MAKE_COMBINING_MAPPER_MAIN(mapper, SUM_REDUCER)
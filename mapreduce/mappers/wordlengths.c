@@ -15,13 +15,14 @@ void mapper(const char *data, FILE *output) {
     char *newline = NULL;
     while ((newline = strchr(data_copy, '\n')) != NULL)
         *newline = ' ';
-    char *datum = strtok(data_copy, " ");
+    char *saveptr = NULL;
+    char *datum = strtok_r(data_copy, " ", &saveptr);
     while (datum) {
         fprintf(output, "%zu: 1\n", strlen(datum));
-        datum = strtok(NULL, " ");
+        datum = strtok_r(NULL, " ", &saveptr);
     }
 
     free(data_copy);
 }
 
-MAKE_MAPPER_MAIN(mapper)
+MAKE_COMBINING_MAPPER_MAIN(mapper, SUM_REDUCER)
@@ -3,6 +3,8 @@
 * CS 241 - Fall 2018
 */
 
+#include "mapper.h"
+#include "runner.h"
 #include "utils.h"
 #include <stdlib.h>
 #include <stdio.h>
@@ -12,9 +14,17 @@
 
 void close_pipes(int*, int);
 void wait_all(pid_t*, int, char*);
+void count_lines(char*);
 
 int main(int argc, char **argv) {
-    if (argc != 6) {
+    // -t runs the job in this process, see core/runner.h
+    int in_process = argc > 1 && strcmp(argv[1], "-t") == 0;
+    if (in_process) {
+        argv++;
+        argc--;
+    }
+    if (argc != 6 && argc != 7) {
+        print_usage();
         exit(1);
     }
     // save/parse arguments
@@ -24,6 +34,19 @@ int main(int argc, char **argv) {
         *reducer = argv[4],
         *num_mappers = argv[5];
     int mapper_count = atoi(num_mappers);
+    int reducer_count = argc == 7 ? atoi(argv[6]) : 1;
+    if (mapper_count < 1 || reducer_count < 1) {
+        print_usage();
+        exit(1);
+    }
+    if (in_process) {
+        if (run_in_process(input_file, output_file, mapper, reducer,
+                           mapper_count, reducer_count) != 0) {
+            exit(1);
+        }
+        count_lines(output_file);
+        return 0;
+    }
     // create pids for splitter and mapper
     pid_t splitter_pids[mapper_count];
     pid_t mapper_pids[mapper_count];
@@ -32,9 +55,26 @@ int main(int argc, char **argv) {
     for (int i = 0; i < mapper_count * 2; i += 2) {
         pipe(mapper_pipes + i);
     }
-    // Create one input pipe for the reducer.
-    int reducer_pipe[2];
-	pipe(reducer_pipe);
+    // Create an input pipe for each reducer. Each mapper writes the keys
+    // of partition i into reducer_pipes[2 * i + 1], see core/mapper.h.
+    int reducer_pipes[reducer_count * 2];
+    for (int i = 0; i < reducer_count * 2; i += 2) {
+        pipe(reducer_pipes + i);
+    }
+    // With more than one reducer, each writes its output into a pipe of its
+    // own, and the outputs are merged here.
+    int output_pipes[reducer_count * 2];
+    int output_pipe_count = reducer_count > 1 ? reducer_count * 2 : 0;
+    for (int i = 0; i < output_pipe_count; i += 2) {
+        pipe(output_pipes + i);
+    }
+    // Tell the mappers where the partitions go: stdout for the first one,
+    // and the write ends they inherit for the others.
+    char partition_fds[reducer_count * 12 + 1];
+    char *fds_end = partition_fds + sprintf(partition_fds, "%d", 1);
+    for (int i = 1; i < reducer_count; ++i) {
+        fds_end += sprintf(fds_end, ",%d", reducer_pipes[2 * i + 1]);
+    }
     // Start a splitter process for each mapper.
     for (int i = 0; i < mapper_count; ++i) {
         splitter_pids[i] = fork();
@@ -48,7 +88,8 @@ int main(int argc, char **argv) {
             }
             // close all pipes
             close_pipes(mapper_pipes, mapper_count * 2);
-            close_pipes(reducer_pipe, 2);
+            close_pipes(reducer_pipes, reducer_count * 2);
+            close_pipes(output_pipes, output_pipe_count);
             // parse integer i to string
             char i_str[20];
             sprintf(i_str, "%d", i);
@@ -64,45 +105,86 @@ int main(int argc, char **argv) {
             exit(1);
         } else if (mapper_pids[i] == 0) {
             int result_0 = dup2(mapper_pipes[i * 2], 0);
-            int result_1 = dup2(reducer_pipe[1], 1);
+            int result_1 = dup2(reducer_pipes[1], 1);
             if (result_0 == -1 || result_1 == -1) {
                 exit(1);
             }
-            // close all pipes
+            // close all pipes but the other partitions' write ends
             close_pipes(mapper_pipes, mapper_count * 2);
-            close_pipes(reducer_pipe, 2);
+            close(reducer_pipes[1]);
+            for (int j = 0; j < reducer_count; ++j) {
+                close(reducer_pipes[2 * j]);
+            }
+            close_pipes(output_pipes, output_pipe_count);
+            if ((reducer_count > 1 &&
+                 setenv(PARTITION_FDS_ENV, partition_fds, 1) == -1) ||
+                setenv(REDUCER_ENV, reducer, 1) == -1) {
+                exit(1);
+            }
             if (execl(mapper, mapper, NULL) == -1) {
                 exit(1);
             }
         }
     }
-    // Start the reducer process.
-    pid_t reducer_pid = fork();
-    if (reducer_pid == -1) {
-        exit(1);
-    } else if (reducer_pid > 0) {
-        close_pipes(mapper_pipes, mapper_count * 2);
-        close_pipes(reducer_pipe, 2);
-    } else {
-        // Open the output file.
-        FILE* output_fp = freopen(output_file, "w+", stdout);
-        if (output_fp == NULL) {
+    // Start the reducer processes.
+    pid_t reducer_pids[reducer_count];
+    for (int i = 0; i < reducer_count; ++i) {
+        reducer_pids[i] = fork();
+        if (reducer_pids[i] == -1) {
             exit(1);
+        } else if (reducer_pids[i] == 0) {
+            if (reducer_count == 1) {
+                // Open the output file.
+                FILE* output_fp = freopen(output_file, "w+", stdout);
+                if (output_fp == NULL) {
+                    exit(1);
+                }
+            } else if (dup2(output_pipes[2 * i + 1], 1) == -1) {
+                exit(1);
+            }
+            int result = dup2(reducer_pipes[2 * i], 0);
+            if (result == -1) {
+                exit(1);
+            }
+            close_pipes(mapper_pipes, mapper_count * 2);
+            close_pipes(reducer_pipes, reducer_count * 2);
+            close_pipes(output_pipes, output_pipe_count);
+            if (execl(reducer, reducer, NULL) == -1) {
+                exit(1);
+            }
         }
-        int result = dup2(reducer_pipe[0], 0);
-        if (result == -1) {
-            exit(1);
+    }
+    close_pipes(mapper_pipes, mapper_count * 2);
+    close_pipes(reducer_pipes, reducer_count * 2);
+    // Merge the reducers' outputs.
+    if (reducer_count > 1) {
+        FILE* outputs[reducer_count];
+        for (int i = 0; i < reducer_count; ++i) {
+            close(output_pipes[2 * i + 1]);
+            outputs[i] = fdopen(output_pipes[2 * i], "r");
+            if (outputs[i] == NULL) {
+                exit(1);
+            }
         }
-        close_pipes(mapper_pipes, mapper_count * 2);
-        close_pipes(reducer_pipe, 2);
-        if (execl(reducer, reducer, NULL) == -1) {
+        FILE* output_fp = fopen(output_file, "w+");
+        if (output_fp == NULL || merge_sorted_outputs(outputs, reducer_count, output_fp) == -1) {
+            perror(output_file);
             exit(1);
         }
+        fclose(output_fp);
+        for (int i = 0; i < reducer_count; ++i) {
+            fclose(outputs[i]);
+        }
     }
-    // Wait for the reducer to finish.
+    // Wait for the reducers to finish.
     wait_all(splitter_pids, mapper_count, "splitter");
     wait_all(mapper_pids, mapper_count, mapper);
-    wait_all(&reducer_pid, 1, reducer);
+    wait_all(reducer_pids, reducer_count, reducer);
+    count_lines(output_file);
+    return 0;
+}
+
+void count_lines(char *output_file) {
     // Count the number of lines in the output file.
     FILE* output_fp = fopen(output_file, "r");
     int num_lines = 0;
@@ -112,7 +194,6 @@ int main(int argc, char **argv) {
     }
     fclose(output_fp);
     printf("%d lines in %s\n", num_lines, output_file);
-    return 0;
 }
 
 void close_pipes(int *pipes, int size) {
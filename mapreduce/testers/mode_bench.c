@@ -0,0 +1,197 @@
+/**
+*  Lab
+* CS 241 - Fall 2018
+*/
+
+/**
+ * Multi-process vs in-process mapreduce benchmark.
+ *
+ * Generates a text file (by default 512 MB of lines of words drawn from a
+ * skewed vocabulary of 200000 words), then runs the same job on it with
+ * ./mapreduce, once with a process per splitter, mapper and reducer
+ * talking through pipes, and once with -t, on threads in this process.
+ * Prints the wall-clock time of both and checks that their outputs match.
+ * Runs the wordcount job unless another mapper is named.
+ *
+ * From the mapreduce directory, after make:
+ * 	gcc -O2 -std=c99 -D_GNU_SOURCE testers/mode_bench.c -o mode_bench
+ * 	./mode_bench [-s megabytes] [-m mappers] [-r reducers] [-j mapper]
+ */
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_MEGABYTES 512
+#define DEFAULT_MAPPERS 4
+#define DEFAULT_REDUCERS 2
+#define WORDS 200000
+
+extern char **environ;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t next_random(uint64_t *state) {
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (uint32_t)(*state >> 33);
+}
+
+/**
+ * Writes 'bytes' of text to path. The generator is seeded with a constant,
+ * so every run writes the same file.
+ */
+static int generate(const char *path, size_t bytes) {
+    FILE *out = fopen(path, "w");
+    if (out == NULL)
+        return -1;
+    uint64_t state = 5381;
+    static char words[WORDS][13];
+    for (size_t i = 0; i < WORDS; ++i) {
+        size_t length = 1 + next_random(&state) % 12;
+        for (size_t j = 0; j < length; ++j)
+            words[i][j] = 'a' + next_random(&state) % 26;
+        words[i][length] = '\0';
+    }
+    size_t written = 0;
+    while (written < bytes) {
+        size_t num_words = next_random(&state) % 15;
+        for (size_t i = 0; i < num_words; ++i) {
+            // the square of a uniform pick favours the start of the vocabulary
+            double pick = next_random(&state) / 4294967296.0;
+            const char *word = words[(size_t)(pick * pick * WORDS)];
+            written += fprintf(out, i ? " %s" : "%s", word);
+        }
+        fputc('\n', out);
+        written++;
+    }
+    return fclose(out);
+}
+
+/**
+ * Runs ./mapreduce with 'args' (NULL terminated), with its stdout sent to
+ * /dev/null, and returns the wall-clock time it took, or -1 if it failed.
+ */
+static double run(char **args) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+                                     O_WRONLY, 0);
+    double start = now();
+    pid_t pid;
+    int error = posix_spawn(&pid, "./mapreduce", &actions, NULL, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (error) {
+        fprintf(stderr, "cannot run ./mapreduce: %s\n", strerror(error));
+        return -1;
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    double elapsed = now() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "./mapreduce %s failed\n", args[1]);
+        return -1;
+    }
+    return elapsed;
+}
+
+/** Returns "boolean" whether the files at a and b have the same contents. */
+static int same_contents(const char *a, const char *b) {
+    FILE *fa = fopen(a, "r"), *fb = fopen(b, "r");
+    int same = fa && fb;
+    while (same) {
+        int ca = getc(fa), cb = getc(fb);
+        same = ca == cb;
+        if (ca == EOF)
+            break;
+    }
+    if (fa)
+        fclose(fa);
+    if (fb)
+        fclose(fb);
+    return same;
+}
+
+int main(int argc, char **argv) {
+    size_t megabytes = DEFAULT_MEGABYTES;
+    int num_mappers = DEFAULT_MAPPERS;
+    int num_reducers = DEFAULT_REDUCERS;
+    const char *job = "wordcount";
+    int c;
+    while ((c = getopt(argc, argv, "s:m:r:j:")) != -1) {
+        if (c == 's') {
+            megabytes = strtoul(optarg, NULL, 10);
+        } else if (c == 'm') {
+            num_mappers = atoi(optarg);
+        } else if (c == 'r') {
+            num_reducers = atoi(optarg);
+        } else if (c == 'j') {
+            job = optarg;
+        } else {
+            fprintf(stderr, "usage: %s [-s megabytes] [-m mappers] [-r reducers] [-j mapper]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (num_mappers < 1 || num_reducers < 1) {
+        fprintf(stderr, "%s: mappers and reducers must be positive\n", argv[0]);
+        return 1;
+    }
+
+    char input[] = "/tmp/mapreduce_bench_XXXXXX";
+    int fd = mkstemp(input);
+    if (fd == -1) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+    if (generate(input, megabytes << 20) != 0) {
+        perror(input);
+        unlink(input);
+        return 1;
+    }
+    char processes_output[sizeof(input) + 10], threads_output[sizeof(input) + 10];
+    sprintf(processes_output, "%s.proc", input);
+    sprintf(threads_output, "%s.thread", input);
+
+    char mapper_exec[256], reducer_exec[] = "./reducer_sum";
+    char mapper_lib[256], reducer_lib[] = "reducer_sum.so";
+    snprintf(mapper_exec, sizeof(mapper_exec), "./mapper_%s", job);
+    snprintf(mapper_lib, sizeof(mapper_lib), "mapper_%s.so", job);
+    char mappers[16], reducers[16];
+    sprintf(mappers, "%d", num_mappers);
+    sprintf(reducers, "%d", num_reducers);
+
+    char *processes[] = {"mapreduce", input, processes_output, mapper_exec,
+                         reducer_exec, mappers, reducers, NULL};
+    char *threads[] = {"mapreduce", "-t", input, threads_output, mapper_lib,
+                       reducer_lib, mappers, reducers, NULL};
+    double processes_time = run(processes);
+    double threads_time = run(threads);
+    int status = 0;
+    if (processes_time >= 0 && threads_time >= 0) {
+        printf("%zu MB, %s, %d mappers, %d reducers\n", megabytes, job,
+               num_mappers, num_reducers);
+        printf("  processes: %8.3f s\n", processes_time);
+        printf("  threads:   %8.3f s\n", threads_time);
+        if (!same_contents(processes_output, threads_output)) {
+            fprintf(stderr, "the outputs differ\n");
+            status = 1;
+        }
+    } else {
+        status = 1;
+    }
+    unlink(input);
+    unlink(processes_output);
+    unlink(threads_output);
+    return status;
+}
@@ -0,0 +1,167 @@
+/**
+*  Lab
+* CS 241 - Fall 2018
+*/
+
+/**
+ * In-process mapreduce stress test.
+ *
+ * Runs many tiny jobs, of a few lines each and some empty, with up to 8
+ * mappers and 4 reducers, through ./mapreduce -t and through the
+ * multi-process ./mapreduce, and checks that both give the same output.
+ * Tiny jobs make the mapper threads publish their last chunk and finish
+ * while the reducer threads are still looking at their queues, which is
+ * where the in-process runner can lose pairs. Stops at the first job whose
+ * outputs differ and keeps its input.
+ *
+ * From the mapreduce directory, after make:
+ * 	gcc -O2 -std=c99 -D_GNU_SOURCE testers/mode_stress.c -o mode_stress
+ * 	./mode_stress [-n jobs] [-j mapper]
+ */
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define DEFAULT_JOBS 1000
+#define MAX_LINES 8
+#define MAX_MAPPERS 8
+#define MAX_REDUCERS 4
+
+extern char **environ;
+
+static uint32_t next_random(uint64_t *state) {
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (uint32_t)(*state >> 33);
+}
+
+/**
+ * Writes up to MAX_LINES lines of words from a small vocabulary to path, so
+ * that keys repeat within and across mappers.
+ */
+static int generate(const char *path, uint64_t *state) {
+    FILE *out = fopen(path, "w");
+    if (out == NULL)
+        return -1;
+    size_t num_lines = next_random(state) % (MAX_LINES + 1);
+    for (size_t i = 0; i < num_lines; ++i) {
+        size_t num_words = next_random(state) % 6;
+        for (size_t j = 0; j < num_words; ++j) {
+            size_t length = 1 + next_random(state) % 3;
+            if (j > 0)
+                fputc(' ', out);
+            for (size_t k = 0; k < length; ++k)
+                fputc('a' + next_random(state) % 4, out);
+        }
+        fputc('\n', out);
+    }
+    return fclose(out);
+}
+
+/**
+ * Runs ./mapreduce with 'args' (NULL terminated), with its stdout sent to
+ * /dev/null. Returns "boolean" whether it succeeded.
+ */
+static int run(char **args) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+                                     O_WRONLY, 0);
+    pid_t pid;
+    int error = posix_spawn(&pid, "./mapreduce", &actions, NULL, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (error) {
+        fprintf(stderr, "cannot run ./mapreduce: %s\n", strerror(error));
+        return 0;
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/** Returns "boolean" whether the files at a and b have the same contents. */
+static int same_contents(const char *a, const char *b) {
+    FILE *fa = fopen(a, "r"), *fb = fopen(b, "r");
+    int same = fa && fb;
+    while (same) {
+        int ca = getc(fa), cb = getc(fb);
+        same = ca == cb;
+        if (ca == EOF)
+            break;
+    }
+    if (fa)
+        fclose(fa);
+    if (fb)
+        fclose(fb);
+    return same;
+}
+
+int main(int argc, char **argv) {
+    long num_jobs = DEFAULT_JOBS;
+    const char *job = "wordcount";
+    int c;
+    while ((c = getopt(argc, argv, "n:j:")) != -1) {
+        if (c == 'n') {
+            num_jobs = atol(optarg);
+        } else if (c == 'j') {
+            job = optarg;
+        } else {
+            fprintf(stderr, "usage: %s [-n jobs] [-j mapper]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    char input[] = "/tmp/mapreduce_stress_XXXXXX";
+    int fd = mkstemp(input);
+    if (fd == -1) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+    char processes_output[sizeof(input) + 10], threads_output[sizeof(input) + 10];
+    sprintf(processes_output, "%s.proc", input);
+    sprintf(threads_output, "%s.thread", input);
+
+    char mapper_exec[256], reducer_exec[] = "./reducer_sum";
+    char mapper_lib[256], reducer_lib[] = "reducer_sum.so";
+    snprintf(mapper_exec, sizeof(mapper_exec), "./mapper_%s", job);
+    snprintf(mapper_lib, sizeof(mapper_lib), "mapper_%s.so", job);
+
+    uint64_t state = 5381;
+    int status = 0;
+    for (long i = 0; i < num_jobs && status == 0; ++i) {
+        if (generate(input, &state) != 0) {
+            perror(input);
+            status = 1;
+            break;
+        }
+        char mappers[16], reducers[16];
+        sprintf(mappers, "%u", 1 + next_random(&state) % MAX_MAPPERS);
+        sprintf(reducers, "%u", 1 + next_random(&state) % MAX_REDUCERS);
+        char *processes[] = {"mapreduce", input, processes_output, mapper_exec,
+                             reducer_exec, mappers, reducers, NULL};
+        char *threads[] = {"mapreduce", "-t", input, threads_output,
+                           mapper_lib, reducer_lib, mappers, reducers, NULL};
+        if (!run(processes) || !run(threads)) {
+            status = 1;
+        } else if (!same_contents(processes_output, threads_output)) {
+            fprintf(stderr,
+                    "job %ld (%s mappers, %s reducers): the outputs differ, "
+                    "input kept in %s\n",
+                    i, mappers, reducers, input);
+            status = 2;
+        }
+    }
+    if (status == 0)
+        printf("%ld jobs, all outputs match\n", num_jobs);
+    if (status != 2)
+        unlink(input);
+    unlink(processes_output);
+    unlink(threads_output);
+    return status != 0;
+}
@@ -0,0 +1,179 @@
+/**
+*  Lab
+* CS 241 - Fall 2018
+*/
+
+/**
+ * Reducer benchmark.
+ *
+ * Feeds a synthetic word count job to run_reducer_on, as the reducer process
+ * would see it from mapper_wordcount: one "word: 1" line per occurrence, by
+ * default 2 GB of them over a vocabulary of 200000 words whose frequencies
+ * are skewed the way natural text is (few words very often, most rarely).
+ * The input is produced by a child process writing into a pipe, so it never
+ * touches the disk, and the reduced output goes to /dev/null unless -o is
+ * given. With -t the counts are summed by the typed int64 reducer, as
+ * reducers/sum.c does, instead of a text reducer. Prints the wall-clock time
+ * of the reduction and its throughput.
+ *
+ * From the mapreduce directory:
+ * 	gcc -O2 -std=c99 -D_GNU_SOURCE -Icore/ testers/reducer_bench.c core/reducer.c core/libds.c core/utils.c -o reducer_bench
+ * 	./reducer_bench [-s megabytes] [-w words] [-o output] [-t]
+ */
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "reducer.h"
+
+#define DEFAULT_MEGABYTES 2048
+#define DEFAULT_WORDS 200000
+// the generator writes this much input at a time
+#define BLOCK_SIZE (16 << 20)
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Sums counts as text, as reducers had to before typed reducers.
+ */
+static const char *sum(const char *value1, const char *value2) {
+    int count1 = atoi(value1);
+    int count2 = atoi(value2);
+
+    char *res;
+    asprintf(&res, "%d", count1 + count2);
+    return res;
+}
+
+static uint32_t next_random(uint64_t *state) {
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (uint32_t)(*state >> 33);
+}
+
+/**
+ * Fills a block of "word: 1" lines drawn from a vocabulary of num_words
+ * generated words, then writes it to fd until 'bytes' have been written.
+ * The generator is seeded with a constant, so every run sees the same input.
+ */
+static int generate(int fd, size_t bytes, size_t num_words) {
+    uint64_t state = 5381;
+    char **words = malloc(num_words * sizeof(char *));
+    char *block = malloc(BLOCK_SIZE);
+    if (words == NULL || block == NULL)
+        return 1;
+    for (size_t i = 0; i < num_words; ++i) {
+        size_t length = 2 + next_random(&state) % 11;
+        words[i] = malloc(length + 1);
+        if (words[i] == NULL)
+            return 1;
+        for (size_t j = 0; j < length; ++j)
+            words[i][j] = 'a' + next_random(&state) % 26;
+        words[i][length] = '\0';
+    }
+    size_t used = 0;
+    while (true) {
+        // the square of a uniform pick favours the start of the vocabulary
+        double pick = next_random(&state) / 4294967296.0;
+        const char *word = words[(size_t)(pick * pick * num_words)];
+        size_t length = strlen(word);
+        if (used + length + 4 > BLOCK_SIZE)
+            break;
+        memcpy(block + used, word, length);
+        memcpy(block + used + length, ": 1\n", 4);
+        used += length + 4;
+    }
+    for (size_t written = 0; written < bytes;) {
+        size_t chunk = bytes - written < used ? bytes - written : used;
+        // only write whole lines
+        while (chunk > 0 && block[chunk - 1] != '\n')
+            chunk--;
+        if (chunk == 0)
+            break;
+        for (size_t done = 0; done < chunk;) {
+            ssize_t result = write(fd, block + done, chunk - done);
+            if (result == -1)
+                return 1;
+            done += result;
+        }
+        written += chunk;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    size_t megabytes = DEFAULT_MEGABYTES;
+    size_t num_words = DEFAULT_WORDS;
+    const char *output_file = "/dev/null";
+    bool typed = false;
+    int c;
+    while ((c = getopt(argc, argv, "s:w:o:t")) != -1) {
+        if (c == 's') {
+            megabytes = strtoul(optarg, NULL, 10);
+        } else if (c == 'w') {
+            num_words = strtoul(optarg, NULL, 10);
+        } else if (c == 'o') {
+            output_file = optarg;
+        } else if (c == 't') {
+            typed = true;
+        } else {
+            fprintf(stderr, "usage: %s [-s megabytes] [-w words] [-o output] [-t]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (num_words < 1)
+        num_words = 1;
+
+    FILE *output = fopen(output_file, "w");
+    if (output == NULL) {
+        perror(output_file);
+        return 1;
+    }
+    int fds[2];
+    if (pipe(fds) == -1) {
+        perror("pipe");
+        return 1;
+    }
+    pid_t child = fork();
+    if (child == -1) {
+        perror("fork");
+        return 1;
+    } else if (child == 0) {
+        close(fds[0]);
+        signal(SIGPIPE, SIG_IGN);
+        exit(generate(fds[1], megabytes << 20, num_words));
+    }
+    close(fds[1]);
+    FILE *input = fdopen(fds[0], "r");
+
+    double start = now();
+    if (typed) {
+        // the spec reducers/sum.c runs with
+        const reducer_spec spec = SUM_REDUCER;
+        run_reducer_spec_on(input, output, &spec);
+    } else
+        run_reducer_on(input, output, sum);
+    double elapsed = now() - start;
+
+    fclose(input);
+    fclose(output);
+    int status;
+    waitpid(child, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "input generator failed\n");
+        return 1;
+    }
+    printf("%zu MB, %zu words, %s reducer: %.3f s, %.1f MB/s\n", megabytes,
+           num_words, typed ? "int64" : "text", elapsed, megabytes / elapsed);
+    return 0;
+}
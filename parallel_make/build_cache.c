@@ -0,0 +1,190 @@
+/**
+* Parallel Make Lab
+* CS 241 - Fall 2018
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "build_cache.h"
+
+#define FNV_PRIME 0x100000001b3ULL
+#define COPY_CHUNK 65536
+
+uint64_t build_cache_hash_bytes(uint64_t hash, const void *data,
+                                size_t length) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+uint64_t build_cache_hash_string(uint64_t hash, const char *string) {
+    return build_cache_hash_bytes(hash, string, strlen(string) + 1);
+}
+
+int build_cache_hash_file(uint64_t *hash, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    char buffer[COPY_CHUNK];
+    ssize_t length;
+    while ((length = read(fd, buffer, sizeof(buffer))) != 0) {
+        if (length == -1) {
+            if (errno == EINTR)
+                continue;
+            close(fd);
+            return -1;
+        }
+        *hash = build_cache_hash_bytes(*hash, buffer, length);
+    }
+    close(fd);
+    return 0;
+}
+
+int build_cache_open(const char *dir) {
+    if (mkdir(dir, 0777) == -1 && errno != EEXIST)
+        return -1;
+    struct stat info;
+    if (stat(dir, &info) == -1 || !S_ISDIR(info.st_mode))
+        return -1;
+    return 0;
+}
+
+/**
+ * Returns the path of the entry for 'key' with 'suffix', which the caller
+ * frees, or NULL if it cannot be allocated.
+ */
+static char *entry_path(const char *dir, uint64_t key, const char *suffix) {
+    char *path = NULL;
+    if (asprintf(&path, "%s/%016" PRIx64 "%s", dir, key, suffix) == -1)
+        return NULL;
+    return path;
+}
+
+static int write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += written;
+        length -= written;
+    }
+    return 0;
+}
+
+/**
+ * Copies 'source' to 'dest' through a temporary file next to 'dest' that is
+ * renamed into place, so readers never see a partial copy. The permission
+ * bits are copied too.
+ */
+static int copy_file(const char *source, const char *dest) {
+    int in = open(source, O_RDONLY);
+    if (in == -1)
+        return -1;
+    struct stat info;
+    char *temp = NULL;
+    if (fstat(in, &info) == -1 || asprintf(&temp, "%s.XXXXXX", dest) == -1) {
+        close(in);
+        return -1;
+    }
+    int out = mkstemp(temp);
+    if (out == -1) {
+        close(in);
+        free(temp);
+        return -1;
+    }
+    char buffer[COPY_CHUNK];
+    ssize_t length;
+    int result = 0;
+    while ((length = read(in, buffer, sizeof(buffer))) != 0) {
+        if (length == -1) {
+            if (errno == EINTR)
+                continue;
+            result = -1;
+            break;
+        }
+        if (write_all(out, buffer, length) == -1) {
+            result = -1;
+            break;
+        }
+    }
+    if (result == 0 && fchmod(out, info.st_mode & 07777) == -1)
+        result = -1;
+    if (close(out) == -1)
+        result = -1;
+    if (result == 0 && rename(temp, dest) == -1)
+        result = -1;
+    if (result == -1)
+        unlink(temp);
+    close(in);
+    free(temp);
+    return result;
+}
+
+/**
+ * Returns whether the files at 'a' and 'b' exist and have the same contents.
+ */
+static bool same_contents(const char *a, const char *b) {
+    struct stat info_a, info_b;
+    if (stat(a, &info_a) == -1 || stat(b, &info_b) == -1 ||
+        info_a.st_size != info_b.st_size)
+        return false;
+    FILE *file_a = fopen(a, "r");
+    FILE *file_b = fopen(b, "r");
+    bool same = file_a != NULL && file_b != NULL;
+    char buffer_a[COPY_CHUNK], buffer_b[COPY_CHUNK];
+    while (same) {
+        size_t length = fread(buffer_a, 1, sizeof(buffer_a), file_a);
+        if (fread(buffer_b, 1, sizeof(buffer_b), file_b) != length ||
+            memcmp(buffer_a, buffer_b, length) != 0)
+            same = false;
+        else if (length < sizeof(buffer_a))
+            break;
+    }
+    if (file_a)
+        fclose(file_a);
+    if (file_b)
+        fclose(file_b);
+    return same;
+}
+
+int build_cache_restore(const char *dir, uint64_t key, const char *target) {
+    char *path = entry_path(dir, key, ".out");
+    if (path == NULL)
+        return 0;
+    int hit = 0;
+    if (access(path, F_OK) == 0) {
+        if (same_contents(path, target))
+            hit = utimensat(AT_FDCWD, target, NULL, 0) == 0;
+        else
+            hit = copy_file(path, target) == 0;
+    }
+    free(path);
+    return hit;
+}
+
+void build_cache_store(const char *dir, uint64_t key, const char *target) {
+    // a rule that leaves no file behind, like a phony one, is run for its
+    // side effects, which a cache entry cannot stand in for
+    if (access(target, F_OK) == -1)
+        return;
+    char *path = entry_path(dir, key, ".out");
+    if (path == NULL)
+        return;
+    copy_file(target, path);
+    free(path);
+}
@@ -0,0 +1,66 @@
+/**
+* Parallel Make Lab
+* CS 241 - Fall 2018
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Content-addressed build cache.
+ *
+ * A rule's key is a hash of its target, its commands and, for each
+ * prerequisite, either the prerequisite file's contents or (for rules that
+ * are not files) the prerequisite's own key. Entries live in a directory as
+ * files named after the key: "<key>.out" holds a copy of the target file a
+ * successful run produced. Rules that leave no file behind are never cached,
+ * so their commands always run.
+ *
+ * Keys are 64-bit FNV-1a hashes.
+ */
+
+/**
+ * Starting value for build_cache_hash_bytes().
+ */
+#define BUILD_CACHE_HASH_INIT 0xcbf29ce484222325ULL
+
+/**
+ * Folds 'length' bytes of 'data' into 'hash' and returns the result.
+ */
+uint64_t build_cache_hash_bytes(uint64_t hash, const void *data,
+                                size_t length);
+
+/**
+ * Folds 'string', including its terminating NUL so that consecutive strings
+ * cannot run into each other, into 'hash' and returns the result.
+ */
+uint64_t build_cache_hash_string(uint64_t hash, const char *string);
+
+/**
+ * Folds the contents of the file at 'path' into '*hash'.
+ * Returns 0 on success and -1 if the file cannot be read.
+ */
+int build_cache_hash_file(uint64_t *hash, const char *path);
+
+/**
+ * Creates the cache directory 'dir' if it does not exist yet.
+ * Returns 0 on success and -1 if it cannot be used.
+ */
+int build_cache_open(const char *dir);
+
+/**
+ * Looks up 'key' in the cache at 'dir'. On a hit, a cached output is copied
+ * to 'target' (unless 'target' already has the same contents, in which case
+ * only its modification time is updated) and 1 is returned. Returns 0 on a
+ * miss or if the output cannot be restored.
+ */
+int build_cache_restore(const char *dir, uint64_t key, const char *target);
+
+/**
+ * Records a successful run of the rule with 'key' in the cache at 'dir' by
+ * copying 'target' into it. Nothing is recorded if 'target' is not a file.
+ * Failures are ignored; the entry is simply missing next time.
+ */
+void build_cache_store(const char *dir, uint64_t key, const char *target);
@@ -0,0 +1,203 @@
+/**
+* Parallel Make Lab
+* CS 241 - Fall 2018
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "command.h"
+
+extern char **environ;
+
+// characters that make a command need the shell: quoting, expansion,
+// redirection, pipelines, lists, globs, comments and assignments
+#define SHELL_CHARS "|&;<>()$`\\\"'*?[]#~=!{}\n"
+#define BLANKS " \t"
+
+/**
+ * A running command, linked into the children list until the reaper
+ * collects it.
+ */
+typedef struct child {
+    pid_t pid;
+    // wait status, valid once done is set
+    int status;
+    bool done;
+    pthread_cond_t cv;
+    struct child *next;
+} child;
+
+// commands that only make sense inside a shell
+static const char *builtins[] = {
+    ".",     "alias", "bg",       "break",  "cd",     "command", "continue",
+    "eval",  "exec",  "exit",     "export", "fg",     "getopts", "hash",
+    "jobs",  "local", "readonly", "read",   "return", "set",     "shift",
+    "times", "trap",  "type",     "ulimit", "umask",  "unalias", "unset",
+    "wait",  NULL};
+
+static pthread_t reaper;
+static bool reaper_running = false;
+// guards children and stopping; held across posix_spawn so the reaper
+// cannot collect a child before it is on the list
+static pthread_mutex_t children_lock = PTHREAD_MUTEX_INITIALIZER;
+// signalled when the list stops being empty, or on shutdown
+static pthread_cond_t children_cv = PTHREAD_COND_INITIALIZER;
+static child *children = NULL;
+static bool stopping = false;
+// children start with SIGPIPE at its default action, even when parmake
+// itself ignores it
+static posix_spawnattr_t attributes;
+
+/**
+ * Waits for children one at a time and wakes whichever thread started each
+ * one. Sleeps on children_cv while nothing is running, since waitid would
+ * fail with ECHILD then.
+ */
+static void *reap(void *data) {
+    (void)data;
+    pthread_mutex_lock(&children_lock);
+    while (true) {
+        while (children == NULL && !stopping)
+            pthread_cond_wait(&children_cv, &children_lock);
+        if (children == NULL)
+            break;
+        pthread_mutex_unlock(&children_lock);
+        siginfo_t info;
+        memset(&info, 0, sizeof(info));
+        int result = waitid(P_ALL, 0, &info, WEXITED);
+        pthread_mutex_lock(&children_lock);
+        if (result == -1) {
+            if (errno == EINTR)
+                continue;
+            // nothing left to wait for; fail whatever is still listed
+            while (children != NULL) {
+                child *c = children;
+                children = c->next;
+                c->status = -1;
+                c->done = true;
+                pthread_cond_signal(&c->cv);
+            }
+            continue;
+        }
+        for (child **link = &children; *link != NULL; link = &(*link)->next) {
+            child *c = *link;
+            if (c->pid != info.si_pid)
+                continue;
+            *link = c->next;
+            c->status = info.si_code == CLD_EXITED ? info.si_status : 128 + info.si_status;
+            c->done = true;
+            pthread_cond_signal(&c->cv);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&children_lock);
+    return NULL;
+}
+
+int command_init(void) {
+    stopping = false;
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    if (posix_spawnattr_init(&attributes) != 0)
+        return -1;
+    posix_spawnattr_setsigdefault(&attributes, &defaults);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF);
+    if (pthread_create(&reaper, NULL, reap, NULL) != 0) {
+        posix_spawnattr_destroy(&attributes);
+        return -1;
+    }
+    reaper_running = true;
+    return 0;
+}
+
+void command_shutdown(void) {
+    if (!reaper_running)
+        return;
+    pthread_mutex_lock(&children_lock);
+    stopping = true;
+    pthread_cond_signal(&children_cv);
+    pthread_mutex_unlock(&children_lock);
+    pthread_join(reaper, NULL);
+    posix_spawnattr_destroy(&attributes);
+    reaper_running = false;
+}
+
+/**
+ * Splits a command into words if it can be run without a shell. Returns a
+ * NULL terminated argv whose strings point into 'copy', or NULL if the shell
+ * is needed. The caller frees the array.
+ */
+static char **simple_argv(char *copy) {
+    if (strpbrk(copy, SHELL_CHARS) != NULL)
+        return NULL;
+    size_t num_words = 0;
+    for (char *c = copy; *c;) {
+        c += strspn(c, BLANKS);
+        if (*c) {
+            num_words++;
+            c += strcspn(c, BLANKS);
+        }
+    }
+    if (num_words == 0)
+        return NULL;
+    char **argv = malloc((num_words + 1) * sizeof(char *));
+    if (argv == NULL)
+        return NULL;
+    char *save = NULL;
+    size_t i = 0;
+    for (char *word = strtok_r(copy, BLANKS, &save); word != NULL;
+         word = strtok_r(NULL, BLANKS, &save))
+        argv[i++] = word;
+    argv[i] = NULL;
+    for (const char **builtin = builtins; *builtin != NULL; ++builtin) {
+        if (strcmp(argv[0], *builtin) == 0) {
+            free(argv);
+            return NULL;
+        }
+    }
+    return argv;
+}
+
+int command_run(const char *command) {
+    char *copy = strdup(command);
+    if (copy == NULL)
+        return -1;
+    char **argv = simple_argv(copy);
+    child c;
+    c.done = false;
+    c.status = -1;
+    pthread_cond_init(&c.cv, NULL);
+
+    pthread_mutex_lock(&children_lock);
+    int error = ENOENT;
+    if (argv != NULL)
+        error = posix_spawnp(&c.pid, argv[0], NULL, &attributes, argv, environ);
+    // the shell also reports commands it cannot find, as system() would
+    if (error != 0) {
+        char *shell_argv[] = {"sh", "-c", (char *)command, NULL};
+        error = posix_spawn(&c.pid, "/bin/sh", NULL, &attributes, shell_argv, environ);
+    }
+    if (error == 0) {
+        c.next = children;
+        children = &c;
+        pthread_cond_signal(&children_cv);
+        while (!c.done)
+            pthread_cond_wait(&c.cv, &children_lock);
+    }
+    pthread_mutex_unlock(&children_lock);
+
+    pthread_cond_destroy(&c.cv);
+    free(argv);
+    free(copy);
+    return error == 0 ? c.status : -1;
+}
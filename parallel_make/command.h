@@ -0,0 +1,35 @@
+/**
+* Parallel Make Lab
+* CS 241 - Fall 2018
+*/
+
+#pragma once
+
+/**
+ * Command execution without system().
+ *
+ * Commands are started with posix_spawn, which does not copy the parent's
+ * page tables the way fork() does. A command with no shell syntax in it is
+ * run directly from PATH; anything else goes through /bin/sh -c, like
+ * system() would. Children are reaped by a single reaper thread, which hands
+ * each exit status to the thread waiting for it.
+ */
+
+/**
+ * Starts the reaper thread. Must be called before command_run().
+ * Returns 0 on success and -1 on failure.
+ */
+int command_init(void);
+
+/**
+ * Runs 'command' and waits for it to finish. Can be called by multiple
+ * threads at once.
+ * Returns 0 if the command exited with status 0, and nonzero otherwise
+ * (including when it could not be started).
+ */
+int command_run(const char *command);
+
+/**
+ * Stops the reaper thread once no commands are running.
+ */
+void command_shutdown(void);
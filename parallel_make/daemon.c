@@ -0,0 +1,199 @@
+/**
+* Parallel Make Lab
+* CS 241 - Fall 2018
+*/
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "daemon.h"
+
+#define BACKLOG 16
+
+/**
+ * Fills in the address of the socket at 'path'.
+ * Returns 0 on success and -1 if the path is too long.
+ */
+static int socket_address(const char *path, struct sockaddr_un *address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address->sun_path, path);
+    return 0;
+}
+
+int daemon_send(const char *path, size_t num_threads, char **targets) {
+    struct sockaddr_un address;
+    if (socket_address(path, &address) == -1)
+        return -1;
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        close(fd);
+        return -1;
+    }
+    // "<threads>\0<goal>\0<goal>\0..."
+    char threads[32];
+    size_t length = snprintf(threads, sizeof(threads), "%zu", num_threads) + 1;
+    for (char **target = targets; *target; ++target)
+        length += strlen(*target) + 1;
+    char *payload = malloc(length);
+    if (payload == NULL) {
+        close(fd);
+        return -1;
+    }
+    char *end = stpcpy(payload, threads) + 1;
+    for (char **target = targets; *target; ++target)
+        end = stpcpy(end, *target) + 1;
+
+    fflush(stdout);
+    fflush(stderr);
+    int fds[2] = {STDOUT_FILENO, STDERR_FILENO};
+    union {
+        char buffer[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {.iov_base = payload, .iov_len = length};
+    struct msghdr message = {.msg_iov = &iov,
+                             .msg_iovlen = 1,
+                             .msg_control = control.buffer,
+                             .msg_controllen = sizeof(control.buffer)};
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(header), fds, sizeof(fds));
+    ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+    free(payload);
+    int32_t status;
+    ssize_t received = -1;
+    if (sent == (ssize_t)length) {
+        do
+            received = recv(fd, &status, sizeof(status), 0);
+        while (received == -1 && errno == EINTR);
+    }
+    close(fd);
+    return received == sizeof(status) ? status : -1;
+}
+
+int daemon_listen(const char *path) {
+    struct sockaddr_un address;
+    if (socket_address(path, &address) == -1)
+        return -1;
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        // a socket nobody is listening on was left by a dead server
+        int error = errno;
+        int probe = error == EADDRINUSE ? socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0) : -1;
+        bool stale = probe != -1 && connect(probe, (struct sockaddr *)&address, sizeof(address)) == -1 &&
+                     errno == ECONNREFUSED;
+        if (probe != -1)
+            close(probe);
+        if (!stale || unlink(path) == -1 ||
+            bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+            if (!stale)
+                errno = error;
+            close(fd);
+            return -1;
+        }
+    }
+    if (listen(fd, BACKLOG) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int daemon_receive(int listener, daemon_request *request) {
+    int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    // peek at the size of the request before reading it
+    ssize_t length = recv(fd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+    char *payload = length > 0 ? malloc(length) : NULL;
+    if (payload == NULL) {
+        close(fd);
+        return -1;
+    }
+    int fds[2];
+    union {
+        char buffer[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {.iov_base = payload, .iov_len = length};
+    struct msghdr message = {.msg_iov = &iov,
+                             .msg_iovlen = 1,
+                             .msg_control = control.buffer,
+                             .msg_controllen = sizeof(control.buffer)};
+    ssize_t received = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+    struct cmsghdr *header = received == length ? CMSG_FIRSTHDR(&message) : NULL;
+    bool valid = header != NULL && header->cmsg_level == SOL_SOCKET &&
+                 header->cmsg_type == SCM_RIGHTS && header->cmsg_len == CMSG_LEN(sizeof(fds));
+    if (valid)
+        memcpy(fds, CMSG_DATA(header), sizeof(fds));
+    else if (header != NULL && header->cmsg_type == SCM_RIGHTS) {
+        // close whatever descriptors did arrive
+        int *extra = (int *)CMSG_DATA(header);
+        for (size_t i = 0; i < (header->cmsg_len - CMSG_LEN(0)) / sizeof(int); ++i)
+            close(extra[i]);
+    }
+    valid = valid && !(message.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) && payload[length - 1] == '\0';
+
+    char *end;
+    unsigned long num_threads = valid ? strtoul(payload, &end, 10) : 0;
+    if (!valid || *end != '\0' || num_threads < 1) {
+        if (valid) {
+            close(fds[0]);
+            close(fds[1]);
+        }
+        free(payload);
+        close(fd);
+        return -1;
+    }
+    size_t num_targets = 0;
+    for (char *c = payload + strlen(payload) + 1; c < payload + length; c += strlen(c) + 1)
+        num_targets++;
+    // the goals are copied out so the request owns a single allocation
+    request->targets = malloc((num_targets + 1) * sizeof(char *) + length);
+    if (request->targets == NULL) {
+        close(fds[0]);
+        close(fds[1]);
+        free(payload);
+        close(fd);
+        return -1;
+    }
+    char *strings = (char *)(request->targets + num_targets + 1);
+    memcpy(strings, payload, length);
+    size_t i = 0;
+    for (char *c = strings + strlen(strings) + 1; c < strings + length; c += strlen(c) + 1)
+        request->targets[i++] = c;
+    request->targets[i] = NULL;
+    free(payload);
+    request->fd = fd;
+    request->num_threads = num_threads;
+    request->out = fds[0];
+    request->err = fds[1];
+    return 0;
+}
+
+void daemon_reply(daemon_request *request, int status) {
+    int32_t message = status;
+    send(request->fd, &message, sizeof(message), MSG_NOSIGNAL);
+    close(request->fd);
+    close(request->out);
+    close(request->err);
+    free(request->targets);
+}
@@ -0,0 +1,65 @@
+/**
+* Parallel Make Lab
+* CS 241 - Fall 2018
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * Client/server protocol of parmake's daemon mode.
+ *
+ * The server (parmake run with PARMAKE_SERVE=socket) keeps a makefile's
+ * graph and the state of its files in memory and builds on behalf of clients
+ * (parmake run with PARMAKE_CONNECT=socket) connecting to a Unix socket. Each request is a single SOCK_SEQPACKET
+ * message holding the thread count and the goals, with the client's stdout
+ * and stderr attached, so commands and diagnostics print on the client's
+ * terminal. The server answers with the build's exit status once it is
+ * done. Requests are served one at a time, in the server's working
+ * directory.
+ */
+
+typedef struct {
+    // connection to answer on
+    int fd;
+    size_t num_threads;
+    // NULL terminated goals, empty for the makefile's default goal
+    char **targets;
+    // the client's stdout and stderr
+    int out;
+    int err;
+} daemon_request;
+
+/**
+ * Sends a request to build 'targets' (NULL terminated) with 'num_threads'
+ * threads to the server at 'path', and waits for it to finish.
+ * Returns the build's exit status, or -1 if no server answered.
+ */
+int daemon_send(const char *path, size_t num_threads, char **targets);
+
+/**
+ * Listens on the Unix socket 'path', replacing a stale socket left by a
+ * server that is gone.
+ * Returns the listening socket, or -1 on failure.
+ */
+int daemon_listen(const char *path);
+
+/**
+ * Accepts one client from 'listener' and reads its request.
+ * Returns 0 on success and -1 if the client went away or sent a malformed
+ * request.
+ */
+int daemon_receive(int listener, daemon_request *request);
+
+/**
+ * Sends 'status' to the client and releases the request.
+ */
+void daemon_reply(daemon_request *request, int status);
+
+/**
+ * Runs the parmake server for 'makefile' on the socket 'path' until it is
+ * killed. Defined in parmake.c.
+ * Returns 1 if the server could not be started.
+ */
+int parmake_serve(char *makefile, const char *path);
@@ -4,69 +4,223 @@
 */
 
 
+#include "build_cache.h"
+#include "command.h"
+#include "daemon.h"
+#include "trace.h"
+#include "watch.h"
 #include "format.h"
 #include "graph.h"
 #include "parmake.h"
 #include "parser.h"
 #include <stdbool.h>
+#include <stdint.h>
 #include "vector.h"
 #include "dictionary.h"
 #include "queue.h"
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 #include <unistd.h>
 #include <time.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <string.h>
 
-int has_cycle(void*);
-int detect_cycle(dictionary*, void*);
-void get_ordered_rules(vector*);
-void get_rules(vector*, vector*, dictionary*);
-void update_dictionary(dictionary*, void*, int);
+// threads used to stat every target before the build starts; stats are
+// mostly waiting on the file system, so this does not follow -j
+#define STAT_THREADS 8
+
+// most workers a server starts for one request; the count comes from the
+// client and the thread handles live on the stack
+#define MAX_REQUEST_THREADS 1024
+
+void build(char*, vector*, size_t);
+bool order_rules(vector*);
+size_t vertex_slot(vector*, size_t*, size_t, void*);
+char *stats_path(char*);
+dictionary *load_stats(char*);
+void save_stats(char*, dictionary*);
+void schedule_rules(dictionary*, bool);
+int compare_priority(const void*, const void*);
+void finish_rule(size_t, void*, int);
+void push_rule(size_t, void*);
+void publish_rules(size_t);
+void *take_rule(size_t);
+void *next_rule(size_t);
+void stat_rules(void);
+void *stat_worker(void*);
+void stat_rule(void*);
+int rule_key(void*);
 int should_run(void*);
 void *run(void*);
+int load_graph(char*, char*);
+int reload_graph(char*, int*);
+int serve_request(char*, daemon_request*);
+void forget_order(void);
+void file_changed(void*);
+void dirty_dependents(void*);
+void free_schedules(void);
+
+/**
+ * Scheduling state of a rule, hung off rule->data while the build runs.
+ */
+typedef struct {
+    char *target;
+    rule_t *rule;
+    // position in the rules vector, used to break ties in makefile order
+    size_t order;
+    // dependencies that have not finished yet
+    size_t pending;
+    // schedules of the rules that depend on this one
+    vector *dependents;
+    // expected run time of this rule plus the longest chain of dependents
+    // after it, in seconds
+    double priority;
+    // how long the commands took, or -1 if they did not run
+    double duration;
+    // build cache key, valid once keyed is set
+    uint64_t key;
+    bool keyed;
+    // whether the target exists as a file and its modification time, read
+    // before the build starts and again after the rule runs
+    bool exists;
+    time_t mtime;
+    // whether exists and mtime need to be read again before the next build;
+    // when serving, only targets whose directory is not watched stay stale
+    bool stale;
+    bool watched;
+    // when serving: the rule was up to date without running last time it was
+    // checked, and nothing it depends on has changed since
+    bool clean;
+} schedule_t;
+
+/**
+ * A worker's ready rules, kept as a binary max-heap on priority. The owner
+ * and thieves both take the top, so whichever worker runs next picks up the
+ * longest critical path it can see; rules a worker unblocks go onto its own
+ * heap.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    schedule_t **rules;
+    size_t size;
+    size_t capacity;
+} worker_t;
 
 graph *g = NULL;
-pthread_cond_t graph_cv = PTHREAD_COND_INITIALIZER;
-pthread_mutex_t graph_lock = PTHREAD_MUTEX_INITIALIZER;
 
 vector *rules = NULL;
-// size_t num_rules = 0;
-pthread_mutex_t rule_lock = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t rule_cv = PTHREAD_COND_INITIALIZER;
+worker_t *workers = NULL;
+size_t num_workers = 0;
+// rules that have not finished yet
+size_t rules_left = 0;
+// rules sitting in some worker's heap. It is raised under idle_lock after
+// the rules are pushed, so a worker that sees none under the lock will be
+// woken; a thief may take a rule first and briefly drive it negative.
+long rules_queued = 0;
+// idle workers sleep on idle_cv until a rule is queued or the build is done
+size_t idle_workers = 0;
+bool build_done = false;
+pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t idle_cv = PTHREAD_COND_INITIALIZER;
+// build cache directory, taken from PARMAKE_CACHE; NULL when caching is off
+char *cache_dir = NULL;
+// next entry of the rules vector for the stat threads to look up
+size_t next_stat = 0;
+// set while parmake serves builds from a graph kept between them, so
+// schedules outlive a build and file state is kept current by inotify
+bool serving = false;
+// when serving: the makefile changed (or changes were lost) and the graph
+// needs to be parsed again, and the goal to build when a client names none
+bool reload = true;
+char *default_goal = NULL;
+// when serving: the goals the rules vector is kept in order for
+vector *ordered_goals = NULL;
 
 
 int parmake(char *makefile, size_t num_threads, char **targets) {
+    // like the cache directory, daemon mode and the trace are asked for in
+    // the environment, as parmake_main.c must not change. main ignores what
+    // parmake returns, so the daemon modes exit with their status.
+    char *client = getenv("PARMAKE_CONNECT");
+    if (client != NULL) {
+        int status = daemon_send(client, num_threads, targets);
+        if (status == -1) {
+            fprintf(stderr, "parmake: no answer from server at '%s'\n", client);
+            exit(2);
+        }
+        exit(status);
+    }
+    char *server = getenv("PARMAKE_SERVE");
+    if (server != NULL) {
+        // or a parmake run by one of the commands would serve too
+        server = strdup(server);
+        unsetenv("PARMAKE_SERVE");
+        exit(parmake_serve(makefile, server));
+    }
+    char *trace_path = getenv("PARMAKE_TRACE");
+    if (trace_path != NULL && trace_open(trace_path) != 0) {
+        fprintf(stderr, "parmake: cannot write trace to '%s'\n", trace_path);
+        exit(2);
+    }
+    uint64_t start = trace_now();
     g = parser_parse_makefile(makefile, targets);
+    trace_span(0, "setup", "parse", start, trace_now());
     if (num_threads < 1) {
         return 0;
     }
     // vector of targets
     vector *target_vector= graph_neighbors(g, "");
-    size_t num_targets = vector_size(target_vector);
-    // look for cycles
+    build(makefile, target_vector, num_threads);
+    graph_destroy(g);
+    vector_destroy(target_vector);
+    trace_close();
+    return 0;
+}
+
+
+// Builds goals with num_threads workers. Outside of server mode the
+// schedules are freed again afterwards.
+void build(char *makefile, vector *goals, size_t num_threads) {
+    // order the rules, looking for cycles on the way, unless a server still
+    // has them in order from the last build of the same goals
+    uint64_t start = trace_now();
+    bool ordered = rules != NULL;
     bool cycle_found = false;
-    for (size_t i = 0; i < num_targets; ++i) {
-        void *curr = vector_get(target_vector, i);
-        if (has_cycle(curr) == 1) {
-            print_cycle_failure((char*) curr);
-            cycle_found = true;
-        }
+    if (!ordered) {
+        rules = shallow_vector_create();
+        cycle_found = order_rules(goals);
     }
+    trace_span(0, "setup", "order_rules", start, trace_now());
     // load rules into queue
     if (!cycle_found) {
-        rules = shallow_vector_create();
-        get_ordered_rules(target_vector);
-        // for (size_t i = 0; i < num_rules; ++i) {
-        //     printf("rule %zu: %s\n", i, (char*)queue_pull(rules));
-        //     fflush(stdout);
-        // }
+        num_workers = num_threads;
+        workers = calloc(num_workers, sizeof(worker_t));
+        for (size_t i = 0; i < num_workers; ++i)
+            pthread_mutex_init(&workers[i].lock, NULL);
+        cache_dir = getenv("PARMAKE_CACHE");
+        if (cache_dir != NULL && (*cache_dir == '\0' || build_cache_open(cache_dir) == -1))
+            cache_dir = NULL;
+        char *path = stats_path(makefile);
+        dictionary *stats = load_stats(path);
+        start = trace_now();
+        schedule_rules(stats, !ordered);
+        trace_span(0, "setup", "schedule_rules", start, trace_now());
+        start = trace_now();
+        stat_rules();
+        trace_span(0, "setup", "stat_rules", start, trace_now());
+        if (command_init() != 0)
+            exit(1);
         // create threads
         pthread_t threads[num_threads]; 
         for (size_t i = 0; i < num_threads; ++i) {
             // failed to create new process
-            if (pthread_create(&threads[i], NULL, run, NULL) != 0)
+            if (pthread_create(&threads[i], NULL, run, (void *)i) != 0)
                 exit(1);
         }
         for (size_t i = 0; i < num_threads; ++i) {
@@ -74,121 +228,574 @@ int parmake(char *makefile, size_t num_threads, char **targets) {
             if (pthread_join(threads[i], NULL) != 0)
                 exit(1);
         }
+        command_shutdown();
+        size_t num_rules = vector_size(rules);
+        for (size_t i = 0; i < num_rules; ++i) {
+            rule_t *rule = graph_get_vertex_value(g, vector_get(rules, i));
+            schedule_t *schedule = rule->data;
+            if (schedule->duration >= 0)
+                dictionary_set(stats, schedule->target, &schedule->duration);
+            if (!serving) {
+                vector_destroy(schedule->dependents);
+                free(schedule);
+                rule->data = NULL;
+            }
+        }
+        save_stats(path, stats);
+        dictionary_destroy(stats);
+        free(path);
+        for (size_t i = 0; i < num_workers; ++i) {
+            pthread_mutex_destroy(&workers[i].lock);
+            free(workers[i].rules);
+        }
+        free(workers);
+    }
+    if (!serving || cycle_found) {
         vector_destroy(rules);
+        rules = NULL;
     }
-    graph_destroy(g);
-    vector_destroy(target_vector);
-    return 0;
 }
 
 
-int has_cycle(void *target) {
-    if (g == NULL)
-        return -1;
-    if (!graph_contains_vertex(g, target))
-        return -1;
-    dictionary *history = string_to_int_dictionary_create();
-    vector *keys = graph_vertices(g);
+// Puts every rule reachable from the goals into the rules vector, each after
+// all of its dependencies (a DFS post-order, goals and dependencies taken in
+// makefile order), and reports every goal that depends on a cycle. Returns
+// whether any cycle was found.
+//
+// The graph is copied once into an integer-indexed adjacency array (CSR),
+// and a single iterative Tarjan pass over it finds the strongly connected
+// components. Tarjan emits a component only after everything it depends on,
+// so the same sweep yields the build order and, for each vertex, whether a
+// cycle is reachable from it. The whole thing is O(V+E) and does not
+// recurse.
+bool order_rules(vector *goals) {
+    vector *vertices = graph_vertices(g);
+    size_t num_vertices = vector_size(vertices);
+    // vertex keys are numbered by their position in vertices, through an
+    // open addressing table on the key pointers, which the graph hands out
+    // unchanged from every call
+    size_t num_slots = 16;
+    while (num_slots < 2 * num_vertices)
+        num_slots *= 2;
+    size_t *slots = calloc(num_slots, sizeof(size_t));
+    for (size_t i = 0; i < num_vertices; ++i) {
+        size_t slot = vertex_slot(vertices, slots, num_slots - 1, vector_get(vertices, i));
+        slots[slot] = i + 1;
+    }
+    // dependencies of vertex i are edges[offsets[i]] to edges[offsets[i + 1] - 1]
+    size_t *offsets = malloc((num_vertices + 1) * sizeof(size_t));
+    offsets[0] = 0;
+    for (size_t i = 0; i < num_vertices; ++i)
+        offsets[i + 1] = offsets[i] + graph_vertex_degree(g, vector_get(vertices, i));
+    size_t *edges = malloc((offsets[num_vertices] + 1) * sizeof(size_t));
+    for (size_t i = 0; i < num_vertices; ++i) {
+        vector *neighbors = graph_neighbors(g, vector_get(vertices, i));
+        size_t num_neighbors = vector_size(neighbors);
+        for (size_t j = 0; j < num_neighbors; ++j)
+            edges[offsets[i] + j] = slots[vertex_slot(vertices, slots, num_slots - 1, vector_get(neighbors, j))] - 1;
+        vector_destroy(neighbors);
+    }
+
+    // Tarjan state: discovery index and lowlink of every visited vertex, the
+    // component stack, and an explicit call stack holding each active
+    // vertex's next edge to follow
+    size_t *index = malloc(num_vertices * sizeof(size_t));
+    size_t *low = malloc(num_vertices * sizeof(size_t));
+    size_t *next_edge = malloc(num_vertices * sizeof(size_t));
+    size_t *component = malloc(num_vertices * sizeof(size_t));
+    size_t *call = malloc(num_vertices * sizeof(size_t));
+    bool *on_stack = calloc(num_vertices, sizeof(bool));
+    bool *reaches_cycle = calloc(num_vertices, sizeof(bool));
+    for (size_t i = 0; i < num_vertices; ++i)
+        index[i] = SIZE_MAX;
+    size_t counter = 0;
+    size_t component_top = 0;
+    size_t call_top = 0;
+
+    size_t num_goals = vector_size(goals);
+    for (size_t i = 0; i < num_goals; ++i) {
+        size_t root = slots[vertex_slot(vertices, slots, num_slots - 1, vector_get(goals, i))] - 1;
+        if (index[root] != SIZE_MAX)
+            continue;
+        index[root] = low[root] = counter++;
+        next_edge[root] = offsets[root];
+        component[component_top++] = root;
+        on_stack[root] = true;
+        call[call_top++] = root;
+        while (call_top > 0) {
+            size_t v = call[call_top - 1];
+            if (next_edge[v] < offsets[v + 1]) {
+                size_t w = edges[next_edge[v]++];
+                if (index[w] == SIZE_MAX) {
+                    index[w] = low[w] = counter++;
+                    next_edge[w] = offsets[w];
+                    component[component_top++] = w;
+                    on_stack[w] = true;
+                    call[call_top++] = w;
+                } else if (on_stack[w] && index[w] < low[v]) {
+                    low[v] = index[w];
+                }
+                continue;
+            }
+            // every dependency of v is done
+            call_top--;
+            if (call_top > 0 && low[v] < low[call[call_top - 1]])
+                low[call[call_top - 1]] = low[v];
+            if (low[v] != index[v])
+                continue;
+            // v roots a component: everything above it on the stack
+            size_t start = component_top;
+            while (component[--start] != v)
+                ;
+            bool cyclic = component_top - start > 1;
+            for (size_t k = start; k < component_top && !cyclic; ++k) {
+                size_t member = component[k];
+                for (size_t e = offsets[member]; e < offsets[member + 1]; ++e) {
+                    // a self-loop, or a dependency already known to reach a cycle
+                    if (edges[e] == member || reaches_cycle[edges[e]]) {
+                        cyclic = true;
+                        break;
+                    }
+                }
+            }
+            for (size_t k = start; k < component_top; ++k) {
+                on_stack[component[k]] = false;
+                reaches_cycle[component[k]] = cyclic;
+                vector_push_back(rules, vector_get(vertices, component[k]));
+            }
+            component_top = start;
+        }
+    }
+
+    bool cycle_found = false;
+    for (size_t i = 0; i < num_goals; ++i) {
+        void *goal = vector_get(goals, i);
+        if (reaches_cycle[slots[vertex_slot(vertices, slots, num_slots - 1, goal)] - 1]) {
+            print_cycle_failure((char *)goal);
+            cycle_found = true;
+        }
+    }
+
+    free(reaches_cycle);
+    free(on_stack);
+    free(call);
+    free(component);
+    free(next_edge);
+    free(low);
+    free(index);
+    free(edges);
+    free(offsets);
+    free(slots);
+    vector_destroy(vertices);
+    return cycle_found;
+}
+
+
+// Returns the slot of order_rules' key table that holds key, or the empty
+// slot where it belongs. Slots hold a position in vertices plus one, so 0
+// marks an empty slot; mask is the table size minus one.
+size_t vertex_slot(vector *vertices, size_t *slots, size_t mask, void *key) {
+    size_t slot = (size_t)(((uintptr_t)key >> 3) * 0x9e3779b97f4a7c15ULL >> 16) & mask;
+    while (slots[slot] != 0 && vector_get(vertices, slots[slot] - 1) != key)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+
+// Command durations from earlier builds are kept next to the makefile, in
+// <makefile>.stats, one "<seconds> <target>" line per rule.
+char *stats_path(char *makefile) {
+    if (makefile == NULL)
+        return NULL;
+    char *path = malloc(strlen(makefile) + sizeof(".stats"));
+    strcpy(path, makefile);
+    strcat(path, ".stats");
+    return path;
+}
+
+
+// Returns a target to seconds dictionary, empty if there is no stats file.
+dictionary *load_stats(char *path) {
+    dictionary *stats = string_to_double_dictionary_create();
+    FILE *file = path ? fopen(path, "r") : NULL;
+    if (file == NULL)
+        return stats;
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &capacity, file)) != -1) {
+        if (length > 0 && line[length - 1] == '\n')
+            line[length - 1] = '\0';
+        char *target;
+        double seconds = strtod(line, &target);
+        if (target == line || *target != ' ' || seconds < 0)
+            continue;
+        dictionary_set(stats, target + 1, &seconds);
+    }
+    free(line);
+    fclose(file);
+    return stats;
+}
+
+
+// Writes the stats to a temporary file next to path which is renamed over
+// it, so that a build that is interrupted, or runs at the same time as
+// another one, never leaves a truncated file behind.
+void save_stats(char *path, dictionary *stats) {
+    if (path == NULL)
+        return;
+    char *temp = malloc(strlen(path) + sizeof(".XXXXXX"));
+    strcpy(temp, path);
+    strcat(temp, ".XXXXXX");
+    int fd = mkstemp(temp);
+    FILE *file = fd == -1 ? NULL : fdopen(fd, "w");
+    if (file == NULL) {
+        if (fd != -1) {
+            close(fd);
+            unlink(temp);
+        }
+        free(temp);
+        return;
+    }
+    vector *keys = dictionary_keys(stats);
     size_t num_keys = vector_size(keys);
     for (size_t i = 0; i < num_keys; ++i) {
-        int value = 0;
-        dictionary_set(history, vector_get(keys, i), &value);
+        char *target = vector_get(keys, i);
+        fprintf(file, "%f %s\n", *(double *)dictionary_get(stats, target), target);
     }
-    int result = detect_cycle(history, target);
-    dictionary_destroy(history);
     vector_destroy(keys);
-    return result;
+    // mkstemp creates the file readable by its owner only
+    fchmod(fd, 0644);
+    if (fclose(file) != 0 || rename(temp, path) == -1)
+        unlink(temp);
+    free(temp);
 }
 
 
-int detect_cycle(dictionary *history, void *target) {
-    int *state = dictionary_get(history, target);
-    // target is in progress, which means cycle is found
-    if (*state == 1)
-        return 1;
-    // target is done   
-    if (*state == 2)
-        return 0;
-    // set state to "in progress"
-    update_dictionary(history, target, 1);
-    // check all of its descendants
-    vector *neighbors = graph_neighbors(g, target);
-    size_t num_neighbors = vector_size(neighbors);
-    for (size_t i = 0; i < num_neighbors; ++i) {
-        if (detect_cycle(history, vector_get(neighbors, i)) == 1) {
-            vector_destroy(neighbors);
-            return 1;
+// Sets up the dependency counters and critical path priorities of every rule
+// to build and deals the ones with no dependencies out to the workers. Each
+// edge is visited a constant number of times, so this is O(V+E) apart from
+// sorting the leaves. Unless link is set, the schedules' dependents are
+// still those of the same rules from the last build.
+void schedule_rules(dictionary *stats, bool link) {
+    size_t num_rules = vector_size(rules);
+    rules_left = num_rules;
+    build_done = false;
+    // rules without history are assumed to take the average time per
+    // command of the ones with it, or a second per command if none have it
+    double known_seconds = 0;
+    size_t known_commands = 0;
+    for (size_t i = 0; i < num_rules; ++i) {
+        void *target = vector_get(rules, i);
+        rule_t *rule = graph_get_vertex_value(g, target);
+        // a server keeps the schedules of earlier builds
+        schedule_t *schedule = rule->data;
+        if (schedule == NULL) {
+            schedule = malloc(sizeof(schedule_t));
+            schedule->target = target;
+            schedule->rule = rule;
+            schedule->dependents = shallow_vector_create();
+            schedule->stale = true;
+            schedule->watched = serving && watch_add(target, rule) == 0;
+            schedule->clean = false;
+            rule->data = schedule;
+        } else if (link) {
+            vector_clear(schedule->dependents);
+        }
+        schedule->order = i;
+        schedule->pending = graph_vertex_degree(g, target);
+        schedule->priority = -1;
+        schedule->duration = -1;
+        schedule->keyed = false;
+        size_t num_commands = vector_size(rule->commands);
+        if (num_commands > 0 && dictionary_contains(stats, target)) {
+            schedule->priority = *(double *)dictionary_get(stats, target);
+            known_seconds += schedule->priority;
+            known_commands += num_commands;
         }
     }
-    // set state to "finished"
-    update_dictionary(history, target, 2);
-    vector_destroy(neighbors);
-    return 0;
+    double command_seconds = known_commands ? known_seconds / known_commands : 1;
+    for (size_t i = 0; i < num_rules; ++i) {
+        schedule_t *schedule = ((rule_t *)graph_get_vertex_value(g, vector_get(rules, i)))->data;
+        if (link) {
+            vector *sub_targets = graph_neighbors(g, schedule->target);
+            size_t num_sub_targets = vector_size(sub_targets);
+            for (size_t j = 0; j < num_sub_targets; ++j) {
+                rule_t *sub_rule = graph_get_vertex_value(g, vector_get(sub_targets, j));
+                vector_push_back(((schedule_t *)sub_rule->data)->dependents, schedule);
+            }
+            vector_destroy(sub_targets);
+        }
+        if (schedule->priority < 0)
+            schedule->priority = vector_size(schedule->rule->commands) * command_seconds;
+    }
+    // rules are in dependency order, so walking it backwards finishes every
+    // rule's dependents before the rule itself
+    vector *leaves = shallow_vector_create();
+    for (size_t i = num_rules; i-- > 0;) {
+        schedule_t *schedule = ((rule_t *)graph_get_vertex_value(g, vector_get(rules, i)))->data;
+        double longest = 0;
+        size_t num_dependents = vector_size(schedule->dependents);
+        for (size_t j = 0; j < num_dependents; ++j) {
+            schedule_t *dependent = vector_get(schedule->dependents, j);
+            if (dependent->priority > longest)
+                longest = dependent->priority;
+        }
+        schedule->priority += longest;
+        if (schedule->pending == 0)
+            vector_push_back(leaves, schedule);
+    }
+    // deal the leaves out round robin, most urgent first
+    size_t num_leaves = vector_size(leaves);
+    qsort(vector_begin(leaves), num_leaves, sizeof(void *), compare_priority);
+    for (size_t i = 0; i < num_leaves; ++i)
+        push_rule(i % num_workers, vector_get(leaves, i));
+    rules_queued = num_leaves;
+    vector_destroy(leaves);
+    if (num_rules == 0)
+        build_done = true;
 }
 
 
-void get_ordered_rules(vector *targets) {
-    dictionary *counter = string_to_int_dictionary_create();
-    vector *keys = graph_vertices(g);
-    size_t num_keys = vector_size(keys);
-    for (size_t i = 0; i < num_keys; ++i) {
-        int value = 0;
-        dictionary_set(counter, vector_get(keys, i), &value);
+// qsort comparator putting the longest critical path first, ties in makefile
+// order.
+int compare_priority(const void *a, const void *b) {
+    schedule_t *x = *(schedule_t **)a;
+    schedule_t *y = *(schedule_t **)b;
+    if (x->priority != y->priority)
+        return x->priority > y->priority ? -1 : 1;
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+
+// Records the outcome of a rule. Dependents whose last unfinished dependency
+// this was go onto the finishing worker's own heap.
+void finish_rule(size_t worker, void *data, int new_state) {
+    schedule_t *schedule = data;
+    // the state is published to dependents by the release on their counters
+    schedule->rule->state = new_state;
+    size_t num_dependents = vector_size(schedule->dependents);
+    size_t num_ready = 0;
+    for (size_t i = 0; i < num_dependents; ++i) {
+        schedule_t *dependent = vector_get(schedule->dependents, i);
+        if (__atomic_sub_fetch(&dependent->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+            push_rule(worker, dependent);
+            num_ready++;
+        }
     }
-    get_rules(rules, targets, counter);
-    vector_destroy(keys);
-    dictionary_destroy(counter);
+    if (num_ready > 0)
+        publish_rules(num_ready);
+    if (__atomic_sub_fetch(&rules_left, 1, __ATOMIC_ACQ_REL) == 0) {
+        pthread_mutex_lock(&idle_lock);
+        build_done = true;
+        pthread_cond_broadcast(&idle_cv);
+        pthread_mutex_unlock(&idle_lock);
+    }
+}
+
+
+// Adds a ready rule to a worker's heap.
+void push_rule(size_t worker, void *data) {
+    worker_t *w = &workers[worker];
+    pthread_mutex_lock(&w->lock);
+    if (w->size == w->capacity) {
+        w->capacity = w->capacity ? 2 * w->capacity : 16;
+        w->rules = realloc(w->rules, w->capacity * sizeof(schedule_t *));
+    }
+    size_t i = w->size++;
+    while (i > 0 && compare_priority(&data, &w->rules[(i - 1) / 2]) < 0) {
+        w->rules[i] = w->rules[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    w->rules[i] = data;
+    pthread_mutex_unlock(&w->lock);
 }
 
 
-void get_rules(vector *result, vector *targets, dictionary *counter) {
-    size_t num_targets = vector_size(targets);
-    for (size_t i = 0; i < num_targets; ++i) {
-        void *target = vector_get(targets, i);
-        vector *sub_targets = graph_neighbors(g, target);
-        get_rules(result, sub_targets, counter);
-        if (*((int*)dictionary_get(counter, target)) == 0) {
-            update_dictionary(counter, target, 1);
-            vector_push_back(result, target);
+// Counts rules the caller just pushed and wakes one idle worker for each of
+// them but the one the caller will run itself.
+void publish_rules(size_t num_ready) {
+    pthread_mutex_lock(&idle_lock);
+    __atomic_add_fetch(&rules_queued, (long)num_ready, __ATOMIC_RELAXED);
+    for (size_t i = 1; i < num_ready && i <= idle_workers; ++i)
+        pthread_cond_signal(&idle_cv);
+    pthread_mutex_unlock(&idle_lock);
+}
+
+
+// Removes the most urgent rule from a worker's heap, or returns NULL if it
+// is empty.
+void *take_rule(size_t worker) {
+    worker_t *w = &workers[worker];
+    schedule_t *top = NULL;
+    pthread_mutex_lock(&w->lock);
+    if (w->size > 0) {
+        top = w->rules[0];
+        schedule_t *last = w->rules[--w->size];
+        size_t i = 0;
+        while (2 * i + 1 < w->size) {
+            size_t child = 2 * i + 1;
+            if (child + 1 < w->size && compare_priority(&w->rules[child + 1], &w->rules[child]) < 0)
+                child++;
+            if (compare_priority(&last, &w->rules[child]) <= 0)
+                break;
+            w->rules[i] = w->rules[child];
+            i = child;
         }
-        vector_destroy(sub_targets);
+        w->rules[i] = last;
     }
+    pthread_mutex_unlock(&w->lock);
+    return top;
 }
 
 
-void update_dictionary(dictionary *dict, void *key, int new_value) {
-    int *value = dictionary_get(dict, key);
-    *value = new_value;
+// Blocks until there is a rule for this worker to run, taking from its own
+// heap first and then stealing from the others, or returns NULL once every
+// rule has finished. Time spent asleep shows up as an idle span in the trace.
+void *next_rule(size_t worker) {
+    uint64_t idle_start = 0;
+    bool idle = false;
+    while (true) {
+        void *data = NULL;
+        for (size_t i = 0; i < num_workers && data == NULL; ++i)
+            data = take_rule((worker + i) % num_workers);
+        if (data != NULL) {
+            __atomic_sub_fetch(&rules_queued, 1, __ATOMIC_RELAXED);
+            if (idle)
+                trace_span(worker + 1, "scheduler", "idle", idle_start, trace_now());
+            return data;
+        }
+        pthread_mutex_lock(&idle_lock);
+        while (!build_done && __atomic_load_n(&rules_queued, __ATOMIC_RELAXED) <= 0) {
+            if (!idle) {
+                idle_start = trace_now();
+                idle = true;
+            }
+            idle_workers++;
+            pthread_cond_wait(&idle_cv, &idle_lock);
+            idle_workers--;
+        }
+        bool done = build_done;
+        pthread_mutex_unlock(&idle_lock);
+        if (done) {
+            if (idle)
+                trace_span(worker + 1, "scheduler", "idle", idle_start, trace_now());
+            return NULL;
+        }
+    }
 }
 
 
-// -1: error found, should not run, and need to be marked as fail
-//  0: dependencies not finished yet, check later
-//  1: all dependecies are satisfied, should run immediately
-//  2: should not run, and need to be marked as satisfied
-//  3: rule is already done, don't do anything
-int should_run(void *target) {
-    rule_t *rule = (rule_t *)graph_get_vertex_value(g, target);
-    if (rule->state != 0) {
-        return 3;
+// Fills in the file metadata of every rule to build that is stale, with up to
+// STAT_THREADS threads (the caller included) taking rules from a shared
+// counter.
+void stat_rules(void) {
+    size_t num_rules = vector_size(rules);
+    size_t num_threads = num_rules < STAT_THREADS ? num_rules : STAT_THREADS;
+    pthread_t threads[STAT_THREADS];
+    size_t started = 0;
+    next_stat = 0;
+    // if a thread cannot be started, the others just do its share
+    while (started + 1 < num_threads &&
+           pthread_create(&threads[started], NULL, stat_worker, NULL) == 0)
+        started++;
+    stat_worker(NULL);
+    for (size_t i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+}
+
+
+void *stat_worker(void *data) {
+    (void) data;
+    size_t num_rules = vector_size(rules);
+    while (true) {
+        size_t i = __atomic_fetch_add(&next_stat, 1, __ATOMIC_RELAXED);
+        if (i >= num_rules)
+            return NULL;
+        schedule_t *schedule = ((rule_t *)graph_get_vertex_value(g, vector_get(rules, i)))->data;
+        if (schedule->stale)
+            stat_rule(schedule);
     }
-    vector *sub_targets = graph_neighbors(g, target);
+}
+
+
+// Reads the file metadata of a rule's target. Called for every stale rule
+// before the build and again once a rule has changed its target, which is
+// the only time it can go stale during a build. Between builds, inotify
+// tells a server which watched targets went stale.
+void stat_rule(void *data) {
+    schedule_t *schedule = data;
+    struct stat info;
+    schedule->exists = stat(schedule->target, &info) == 0;
+    schedule->mtime = schedule->exists ? info.st_mtime : 0;
+    schedule->stale = !schedule->watched;
+}
+
+
+// Computes the build cache key of a rule that is about to run from its
+// target, its commands and its dependencies: the contents of those that are
+// files and the keys of those that are not. Returns -1 if a dependency could
+// not be hashed, in which case the rule bypasses the cache.
+int rule_key(void *data) {
+    schedule_t *schedule = data;
+    uint64_t key = build_cache_hash_string(BUILD_CACHE_HASH_INIT, schedule->target);
+    vector *commands = schedule->rule->commands;
+    size_t num_commands = vector_size(commands);
+    for (size_t i = 0; i < num_commands; ++i)
+        key = build_cache_hash_string(key, vector_get(commands, i));
+    vector *sub_targets = graph_neighbors(g, schedule->target);
     size_t num_sub_targets = vector_size(sub_targets);
+    for (size_t i = 0; i < num_sub_targets; ++i) {
+        char *sub_target = vector_get(sub_targets, i);
+        schedule_t *sub_schedule = ((rule_t *)graph_get_vertex_value(g, sub_target))->data;
+        key = build_cache_hash_string(key, sub_target);
+        if (sub_schedule->exists) {
+            if (build_cache_hash_file(&key, sub_target) == -1) {
+                vector_destroy(sub_targets);
+                return -1;
+            }
+        } else {
+            if (!sub_schedule->keyed) {
+                vector_destroy(sub_targets);
+                return -1;
+            }
+            key = build_cache_hash_bytes(key, &sub_schedule->key, sizeof(sub_schedule->key));
+        }
+    }
+    vector_destroy(sub_targets);
+    schedule->key = key;
+    schedule->keyed = true;
+    return 0;
+}
+
+
+// Called once all dependencies of a rule have finished. File checks use the
+// metadata read by stat_rule instead of going to the file system.
+// -1: a dependency failed, mark as fail
+//  1: should run now
+//  2: should not run, and need to be marked as satisfied
+int should_run(void *data) {
+    schedule_t *schedule = data;
+    vector *sub_targets = graph_neighbors(g, schedule->target);
+    size_t num_sub_targets = vector_size(sub_targets);
+    // fail if any sub-rule failed
+    for (size_t i = 0; i < num_sub_targets; ++i) {
+        rule_t *sub_rule = graph_get_vertex_value(g, vector_get(sub_targets, i));
+        if (sub_rule->state == -1) {
+            vector_destroy(sub_targets);
+            return -1;
+        }
+    }
     if (num_sub_targets > 0) {
         // if target is file
-        if (access(target, F_OK) != -1) {
+        if (schedule->exists) {
             for (size_t i = 0; i < num_sub_targets; ++i) {
-                char *sub_target = vector_get(sub_targets, i);
+                rule_t *sub_rule = graph_get_vertex_value(g, vector_get(sub_targets, i));
+                schedule_t *sub_schedule = sub_rule->data;
                 // if sub-target is also a file, compare time
-                if (access(sub_target, F_OK) != -1) {
-                    struct stat stat_0, stat_1;
-                    // failed to read file's stat
-	                if (stat((char *)target, &stat_0) == -1 || stat(sub_target, &stat_1) == -1) {
-                        vector_destroy(sub_targets);
-                        return -1;
-                    }   
+                if (sub_schedule->exists) {
                     // if sub-target is newer than target
-	                if (difftime(stat_0.st_mtime, stat_1.st_mtime) < 0) {
+                    if (difftime(schedule->mtime, sub_schedule->mtime) < 0) {
                         vector_destroy(sub_targets);
                         return 1;
                     }
@@ -199,143 +806,338 @@ int should_run(void *target) {
             }
             vector_destroy(sub_targets);
             return 2;
-        } else {
-            // check if all sub-rules succeed
-            pthread_mutex_lock(&graph_lock);
-            for (size_t i = 0; i < num_sub_targets; ++i) {
-                rule_t *sub_rule = graph_get_vertex_value(g, vector_get(sub_targets, i));
-                int state = sub_rule->state;
-                if (state != 1) {
-                    pthread_mutex_unlock(&graph_lock);
-                    vector_destroy(sub_targets);
-                    return state;
-                }
-            }
-            pthread_mutex_unlock(&graph_lock);
-            vector_destroy(sub_targets);
-            return 1;
         }
+        vector_destroy(sub_targets);
+        return 1;
     } else {
         vector_destroy(sub_targets);
-        return access(target, F_OK) != -1 ? 2 : 1;
+        return schedule->exists ? 2 : 1;
     }
 }
 
 
 
 void *run(void *data) {
-    (void) data;
+    size_t worker = (size_t)data;
+    if (trace_enabled()) {
+        char name[32];
+        snprintf(name, sizeof(name), "worker %zu", worker);
+        trace_thread_name(worker + 1, name);
+    }
     while (true) {
-        pthread_mutex_lock(&rule_lock);
-        size_t num_rules = vector_size(rules);
-        if (num_rules > 0) {
-            for (size_t i = 0; i < num_rules; ++i) {
-                void *target = vector_get(rules, i);
-                int status = should_run(target);
-                rule_t *rule = graph_get_vertex_value(g, target);
-                if (status == 1) {
-                    vector_erase(rules, i);
-                    pthread_mutex_unlock(&rule_lock);
-                    vector *commands = rule->commands;
-                    size_t num_commands = vector_size(commands);
-                    int new_state = 1;
-                    for (size_t i = 0; i < num_commands; ++i) {
-                        if (system((char *)vector_get(commands, i)) != 0) {
-                            new_state = -1;
-                            break;
-	                    }
+        schedule_t *schedule = next_rule(worker);
+        if (schedule == NULL)
+            return NULL;
+        uint64_t picked = trace_now();
+        // a clean rule would be found up to date again
+        bool skipped = schedule->clean;
+        int status = skipped ? 2 : should_run(schedule);
+        uint64_t checked = trace_now();
+        vector *commands = schedule->rule->commands;
+        size_t num_run = 0;
+        int exit_status = -1;
+        int new_state = status == -1 ? -1 : 1;
+        if (status == 1) {
+            // a cached result stands in for running the commands
+            bool cached = cache_dir != NULL && rule_key(schedule) == 0;
+            if (cached && build_cache_restore(cache_dir, schedule->key, schedule->target)) {
+                stat_rule(schedule);
+            } else {
+                size_t num_commands = vector_size(commands);
+                struct timespec start, end;
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                while (num_run < num_commands) {
+                    exit_status = command_run(vector_get(commands, num_run++));
+                    if (exit_status != 0) {
+                        new_state = -1;
+                        break;
                     }
-                    pthread_mutex_lock(&graph_lock);
-                    rule->state = new_state;
-                    pthread_cond_broadcast(&rule_cv);
-                    pthread_mutex_unlock(&graph_lock);
-                    break;
-                } else if (status == -1 || status == 2) {
-                    vector_erase(rules, i);
-                    pthread_mutex_unlock(&rule_lock);
-                    pthread_mutex_lock(&graph_lock);
-                    rule->state = status == -1 ? -1 : 1;
-                    pthread_cond_broadcast(&rule_cv);
-                    pthread_mutex_unlock(&graph_lock);
-                    break;
-                } else if (status == 3) {
-                    vector_erase(rules, i);
-                    pthread_mutex_unlock(&rule_lock);
-                    break;
-                } else if (i == num_rules - 1) {
-                    pthread_cond_wait(&rule_cv, &rule_lock);
-                    pthread_mutex_unlock(&rule_lock);
-                    break;
                 }
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                if (num_commands > 0)
+                    schedule->duration = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+                if (cached && new_state == 1)
+                    build_cache_store(cache_dir, schedule->key, schedule->target);
+                // the commands may have created or updated the target
+                if (num_commands > 0)
+                    stat_rule(schedule);
             }
-        } else {
-            pthread_mutex_unlock(&rule_lock);
-            return NULL;
         }
-        
-        // int status = should_run(target);
-        // while (status == 0) {
-        //     pthread_mutex_lock(&graph_lock);
-        //     pthread_cond_wait(&graph_cv, &graph_lock);
-        //     pthread_mutex_unlock(&graph_lock);
-        //     status = should_run(target);
-        // }
-        // if (status == 1) {
-        //     vector *commands = rule->commands;
-        //     size_t num_commands = vector_size(commands);
-        //     for (size_t i = 0; i < num_commands; ++i) {
-        //         if (system((char *)vector_get(commands, i)) != 0) {
-        //             pthread_mutex_lock(&graph_lock);
-        //             rule->state = -1;
-        //             pthread_cond_broadcast(&graph_cv);
-        //             pthread_mutex_unlock(&graph_lock);
-        //             break;
-	    //         }
-        //     }
-        // } else if (status == -1 || status == 2) {
-        //     pthread_mutex_lock(&graph_lock);
-        //     rule->state = status == -1 ? -1 : 1;
-        //     pthread_cond_broadcast(&graph_cv);
-        //     pthread_mutex_unlock(&graph_lock);
-        // }
-
-
-
-
-        // rule_t *rule = graph_get_vertex_value(g, target);
-        // while (true) {
-        //     int status = should_run(target);
-        //     if (status == 0) {
-        //         pthread_mutex_lock(&graph_lock);
-        //         pthread_cond_wait(&graph_cv, &graph_lock);
-        //         pthread_mutex_unlock(&graph_lock);
-        //     } else if (status == 1) {
-        //         pthread_mutex_unlock(&graph_lock);
-        //         vector *commands = rule->commands;
-        //         size_t num_commands = vector_size(commands);
-        //         int new_state = 1;
-        //         for (size_t i = 0; i < num_commands; ++i) {
-        //             if (system((char *)vector_get(commands, i)) != 0) {
-        //                 new_state = -1;
-        //                 break;
-	    //             }
-        //         }
-        //         pthread_mutex_lock(&graph_lock);
-        //         rule->state = new_state;
-        //         pthread_cond_broadcast(&graph_cv);
-        //         pthread_mutex_unlock(&graph_lock);
-        //         break;
-        //     } else if (status == 3) {
-        //         pthread_mutex_unlock(&graph_lock);
-        //         break;
-        //     } else {
-        //         rule->state = status == -1 ? -1 : 1;
-        //         pthread_cond_broadcast(&graph_cv);
-        //         pthread_mutex_unlock(&graph_lock);
-        //         break;
-        //     }
-        // }
+        if (serving) {
+            schedule->clean = schedule->watched && status == 2;
+            // anything but finding the rule up to date may change what its
+            // dependents decide, in this build or a later one
+            if (!skipped && status != 2)
+                dirty_dependents(schedule);
+        }
+        trace_rule(worker + 1, schedule->target, picked, checked, trace_now(),
+                   (char **)vector_begin(commands), num_run, exit_status, new_state);
+        finish_rule(worker, schedule, new_state);
+    }
+}
+
+
+// Serves builds of makefile to parmake clients (see daemon.h) until killed.
+// The graph and the schedules, with the file metadata they hold, are kept
+// between builds, and inotify reports which targets changed in between, so
+// a build only stats what changed and only checks the rules downstream of
+// it; every other rule is known to be up to date.
+int parmake_serve(char *makefile, const char *path) {
+    int listener = daemon_listen(path);
+    if (listener == -1) {
+        fprintf(stderr, "parmake: cannot listen on '%s': %s\n", path, strerror(errno));
+        return 1;
+    }
+    // a client that goes away mid-build must not take the server with it
+    signal(SIGPIPE, SIG_IGN);
+    serving = true;
+    int out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    int err = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+    // makefile errors end the server, as they end parmake, so the first
+    // parse happens before any client connects
+    int watch_fd = load_graph(makefile, makefile);
+    while (true) {
+        struct pollfd fds[2] = {{listener, POLLIN, 0}, {watch_fd, POLLIN, 0}};
+        if (poll(fds, watch_fd == -1 ? 1 : 2, -1) == -1)
+            continue;
+        // keep the inotify queue short while idle
+        if (watch_fd != -1 && (fds[1].revents & POLLIN) && watch_read(file_changed))
+            reload = true;
+        daemon_request request;
+        if (!(fds[0].revents & POLLIN) || daemon_receive(listener, &request) == -1)
+            continue;
+        fflush(stdout);
+        fflush(stderr);
+        dup2(request.out, STDOUT_FILENO);
+        dup2(request.err, STDERR_FILENO);
+        // inotify queues an event before the change returns, so draining
+        // here sees everything the client did before asking
+        if (watch_fd != -1 && watch_read(file_changed))
+            reload = true;
+        // a makefile that no longer parses fails the builds asked for until
+        // it is fixed, and the server keeps the graph it had
+        int status = 2;
+        if (!reload || reload_graph(makefile, &watch_fd) == 0)
+            status = serve_request(makefile, &request);
+        fflush(stdout);
+        fflush(stderr);
+        dup2(out, STDOUT_FILENO);
+        dup2(err, STDERR_FILENO);
+        daemon_reply(&request, status);
+    }
+}
+
+
+// (Re)parses the makefile for the server from source, the makefile itself
+// or a copy of it, dropping everything known about the old graph, and
+// starts watching the makefile again. Returns the inotify descriptor, or -1
+// if nothing can be watched, in which case every build reloads and stats
+// everything.
+int load_graph(char *makefile, char *source) {
+    if (g != NULL) {
+        forget_order();
+        free_schedules();
+        graph_destroy(g);
+        free(default_goal);
+    }
+    watch_destroy();
+    int watch_fd = watch_init();
+    // changes to the makefile itself come back with a NULL tag
+    reload = watch_add(makefile, NULL) == -1;
+    g = parser_parse_makefile(source, NULL);
+    vector *goals = graph_neighbors(g, "");
+    default_goal = vector_size(goals) > 0 ? strdup(vector_get(goals, 0)) : NULL;
+    vector_destroy(goals);
+    return watch_fd;
+}
+
+
+// Parses the makefile again for a running server. The parser exits on
+// errors, so a copy of the makefile is parsed in a child process first, with
+// its messages relayed to the client under the makefile's name, and the
+// server only parses the same copy and replaces its graph if that worked.
+// Returns 0 on success and -1 if the old graph is kept.
+int reload_graph(char *makefile, int *watch_fd) {
+    int in = open(makefile, O_RDONLY | O_CLOEXEC);
+    FILE *copy = in == -1 ? NULL : tmpfile();
+    if (copy == NULL) {
+        fprintf(stderr, "parmake: %s: %s\n", makefile, strerror(errno));
+        if (in != -1)
+            close(in);
+        return -1;
+    }
+    char buffer[65536];
+    ssize_t length;
+    while ((length = read(in, buffer, sizeof(buffer))) > 0 ||
+           (length == -1 && errno == EINTR)) {
+        if (length > 0)
+            fwrite(buffer, 1, length, copy);
+    }
+    close(in);
+    fflush(copy);
+    char source[32];
+    snprintf(source, sizeof(source), "/proc/self/fd/%d", fileno(copy));
+
+    int messages[2];
+    if (pipe2(messages, O_CLOEXEC) == -1) {
+        perror("parmake");
+        fclose(copy);
+        return -1;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    pid_t child = fork();
+    if (child == 0) {
+        dup2(messages[1], STDERR_FILENO);
+        graph *parsed = parser_parse_makefile(source, NULL);
+        vector *goals = graph_neighbors(parsed, "");
+        _exit(vector_size(goals) > 0 ? 0 : 2);
+    }
+    close(messages[1]);
+    // the parser names the file it reads in some messages
+    size_t source_length = strlen(source);
+    char *output = NULL;
+    size_t output_size = 0;
+    FILE *relay = open_memstream(&output, &output_size);
+    while ((length = read(messages[0], buffer, sizeof(buffer))) > 0 ||
+           (length == -1 && errno == EINTR)) {
+        if (length > 0 && relay != NULL)
+            fwrite(buffer, 1, length, relay);
+    }
+    close(messages[0]);
+    int status = -1;
+    if (child != -1)
+        waitpid(child, &status, 0);
+    if (relay != NULL) {
+        fclose(relay);
+        for (char *line = output; line < output + output_size;) {
+            char *end = memchr(line, '\n', output + output_size - line);
+            end = end ? end + 1 : output + output_size;
+            if ((size_t)(end - line) >= source_length &&
+                strncmp(line, source, source_length) == 0) {
+                fputs(makefile, stderr);
+                line += source_length;
+            }
+            fwrite(line, 1, end - line, stderr);
+            line = end;
+        }
+        free(output);
+    }
+    if (child == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        if (child == -1)
+            perror("parmake");
+        else if (WIFEXITED(status) && WEXITSTATUS(status) == 2 && output_size == 0)
+            fprintf(stderr, "parmake: *** No targets.  Stop.\n");
+        fclose(copy);
+        return -1;
     }
+    *watch_fd = load_graph(makefile, source);
+    fclose(copy);
+    return 0;
 }
 
 
+// Builds the goals of one client request. The "" sentinel is pointed at
+// them, as parser_parse_makefile does for the goals it is given, which also
+// turns the client's strings into the graph's own keys. Returns the exit
+// status for the client.
+int serve_request(char *makefile, daemon_request *request) {
+    char *defaults[] = {default_goal, NULL};
+    char **targets = *request->targets ? request->targets : defaults;
+    if (*targets == NULL) {
+        fprintf(stderr, "parmake: *** No targets.  Stop.\n");
+        return 2;
+    }
+    if (request->num_threads < 1 || request->num_threads > MAX_REQUEST_THREADS) {
+        fprintf(stderr, "parmake: -j must be between 1 and %d\n", MAX_REQUEST_THREADS);
+        return 2;
+    }
+    for (char **target = targets; *target; ++target) {
+        if (!graph_contains_vertex(g, *target)) {
+            fprintf(stderr, "parmake: *** No rule to make target '%s'.  Stop.\n", *target);
+            return 1;
+        }
+    }
+    // a different list of goals needs ordering again
+    size_t num_targets = 0;
+    while (targets[num_targets])
+        num_targets++;
+    bool same = ordered_goals != NULL && vector_size(ordered_goals) == num_targets;
+    for (size_t i = 0; same && i < num_targets; ++i)
+        same = strcmp(vector_get(ordered_goals, i), targets[i]) == 0;
+    if (!same) {
+        forget_order();
+        ordered_goals = string_vector_create();
+        for (size_t i = 0; i < num_targets; ++i)
+            vector_push_back(ordered_goals, targets[i]);
+    }
+    vector *goals = graph_neighbors(g, "");
+    size_t num_goals = vector_size(goals);
+    for (size_t i = 0; i < num_goals; ++i)
+        graph_remove_edge(g, "", vector_get(goals, i));
+    vector_destroy(goals);
+    for (char **target = targets; *target; ++target)
+        graph_add_edge(g, "", *target);
+    goals = graph_neighbors(g, "");
+    build(makefile, goals, request->num_threads);
+    vector_destroy(goals);
+    return 0;
+}
+
+
+// Drops the rules vector a server keeps in order between builds.
+void forget_order(void) {
+    if (rules != NULL)
+        vector_destroy(rules);
+    rules = NULL;
+    if (ordered_goals != NULL)
+        vector_destroy(ordered_goals);
+    ordered_goals = NULL;
+}
+
+
+// inotify callback for a watched file that changed between builds; the tag
+// is the rule of that target, or NULL for the makefile.
+void file_changed(void *data) {
+    if (data == NULL) {
+        reload = true;
+        return;
+    }
+    schedule_t *schedule = ((rule_t *)data)->data;
+    schedule->stale = true;
+    schedule->clean = false;
+    dirty_dependents(schedule);
+}
+
+
+// Makes every rule that depends on this one, whether or not it is part of
+// the current build, check again next time it is built.
+void dirty_dependents(void *data) {
+    schedule_t *schedule = data;
+    vector *dependents = graph_antineighbors(g, schedule->target);
+    size_t num_dependents = vector_size(dependents);
+    for (size_t i = 0; i < num_dependents; ++i) {
+        schedule_t *dependent = ((rule_t *)graph_get_vertex_value(g, vector_get(dependents, i)))->data;
+        // rules never built have nothing to forget
+        if (dependent != NULL)
+            __atomic_store_n(&dependent->clean, false, __ATOMIC_RELAXED);
+    }
+    vector_destroy(dependents);
+}
+
+
+// Frees the schedules a server keeps between builds.
+void free_schedules(void) {
+    vector *vertices = graph_vertices(g);
+    size_t num_vertices = vector_size(vertices);
+    for (size_t i = 0; i < num_vertices; ++i) {
+        rule_t *rule = graph_get_vertex_value(g, vector_get(vertices, i));
+        schedule_t *schedule = rule->data;
+        if (schedule != NULL) {
+            vector_destroy(schedule->dependents);
+            free(schedule);
+            rule->data = NULL;
+        }
+    }
+    vector_destroy(vertices);
+}
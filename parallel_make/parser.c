@@ -3,12 +3,17 @@
 * CS 241 - Fall 2018
 */
 
-#include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "callbacks.h"
 #include "compare.h"
@@ -17,156 +22,226 @@
 #include "rule.h"
 #include "vector.h"
 
+// interned names are packed into chunks of at least this many bytes
+#define CHUNK_SIZE 65536
+#define READ_CHUNK 65536
+
 /**
- * Creates dynamically sized array of tokens from string. The tokens
- * themselves are NOT dynamically allocated, however.
- *
- * Tokens are separated by spaces.
+ * A block of interned names. Every name is preceded by a pointer back to its
+ * chunk, and the chunk counts the graph keys using any of its names, plus
+ * one for the parser while it is still adding names.
  */
-static char **split_line_on_spaces(char *line) {
-    assert(line != NULL);
-    size_t space_count = 0;
-    for (char *ptr = line; *ptr; ++ptr)
-        if (*ptr == ' ')
-            ++space_count;
-    char **tokens = malloc((2 + space_count) * sizeof(char *));
-    size_t tokIdx = 0;
-    while (1) {
-        tokens[tokIdx] = strtok(line, " ");
-        line = NULL;
-        if (!tokens[tokIdx])
-            break;
-        if (*tokens[tokIdx]) // If strtok gives empty string, don't increment
-                             // idx
-            ++tokIdx;
-    };
-    return realloc(tokens, sizeof(char *) * (tokIdx + 1));
-}
+typedef struct chunk {
+    size_t refs;
+    size_t used;
+    size_t size;
+    struct chunk *next;
+    char *data;
+} chunk;
 
 /**
- * Vertex value copy constructor invoked by the graph when its vertex value
- * is set. This copy constructor takes in a string `s` and returns a rule_t
- * struct initialized so that its target is a deep copy of `s`.
+ * A name seen in the makefile and the rule of its vertex.
  */
-static void *str_to_rule_constructor(void *s) {
-    if (!s)
-        return NULL;
-    rule_t *out = malloc(sizeof(rule_t));
-    rule_init(out);
-    out->target = (char *)string_copy_constructor(s);
-    return out;
-}
+typedef struct {
+    char *name;
+    size_t length;
+    size_t hash;
+    rule_t *rule;
+} intern_entry;
 
 /**
- * Rule destructor invoked by the graph when it needs to destroy a vertex.
+ * String table mapping each distinct name in the makefile to its one copy,
+ * by open addressing. The names double as the graph's keys, so a name is
+ * looked up in the graph only when it is first seen.
  */
-static void rule_destroy_v(void *r) {
-    rule_t *rule = (rule_t *)r;
-    rule_destroy(rule);
+typedef struct {
+    intern_entry *entries;
+    size_t capacity;
+    size_t size;
+    chunk *chunks;
+} intern_table;
+
+/**
+ * Vertex key copy constructor: keys are interned names, so copying one only
+ * takes a reference to its chunk.
+ */
+static void *intern_retain(void *key) {
+    chunk *c = ((chunk **)key)[-1];
+    c->refs++;
+    return key;
 }
 
 /**
- * Return true if the current line refers to a valid Makefile target name
+ * Vertex key destructor: drops the reference intern_retain took, freeing
+ * the chunk with the last one.
  */
-static bool is_makefile_target(char const *line) {
-    return isalnum(line[0]) || (line[0] == '.') || line[0] == '/';
+static void intern_release(void *key) {
+    chunk *c = ((chunk **)key)[-1];
+    if (--c->refs == 0)
+        free(c);
+}
+
+static size_t hash_name(const char *name, size_t length) {
+    size_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char)name[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
 }
 
 /**
- * Discard all line number information from vertices for user's sake
+ * Copies a name into the table's newest chunk, starting a new one if it
+ * does not fit, and returns the copy.
  */
-static void zero_out_states(graph *dependency_graph) {
-    vector *vertices = graph_vertices(dependency_graph);
-    VECTOR_FOR_EACH(vertices, target, {
-        ((rule_t *)graph_get_vertex_value(dependency_graph, target))->state = 0;
-    });
-    vector_destroy(vertices);
+static char *arena_copy(intern_table *table, const char *name, size_t length) {
+    // the back pointer keeps every name aligned for it
+    size_t needed = sizeof(chunk *) + (length + 1 + sizeof(chunk *) - 1) / sizeof(chunk *) * sizeof(chunk *);
+    chunk *c = table->chunks;
+    if (c == NULL || c->size - c->used < needed) {
+        size_t size = needed > CHUNK_SIZE ? needed : CHUNK_SIZE;
+        c = malloc(sizeof(chunk) + size);
+        if (c == NULL) {
+            perror("parmake");
+            exit(2);
+        }
+        c->refs = 1;
+        c->used = 0;
+        c->size = size;
+        c->data = (char *)(c + 1);
+        c->next = table->chunks;
+        table->chunks = c;
+    }
+    char *copy = c->data + c->used + sizeof(chunk *);
+    ((chunk **)copy)[-1] = c;
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+    c->used += needed;
+    return copy;
+}
+
+static void intern_grow(intern_table *table) {
+    size_t capacity = table->capacity ? 2 * table->capacity : 1024;
+    intern_entry *entries = calloc(capacity, sizeof(intern_entry));
+    if (entries == NULL) {
+        perror("parmake");
+        exit(2);
+    }
+    for (size_t i = 0; i < table->capacity; ++i) {
+        intern_entry *e = &table->entries[i];
+        if (e->name == NULL)
+            continue;
+        size_t slot = e->hash & (capacity - 1);
+        while (entries[slot].name != NULL)
+            slot = (slot + 1) & (capacity - 1);
+        entries[slot] = *e;
+    }
+    free(table->entries);
+    table->entries = entries;
+    table->capacity = capacity;
 }
 
 /**
- * Return a pointer to the first non-whitespace character in `str`, or to
- * the null byte if none exists.
+ * Returns the entry for the name of 'length' bytes at 'name', which need not
+ * be NUL terminated. A name seen for the first time is copied into the
+ * arena and added to the graph as a new vertex.
  */
-static char *skip_whitespace(char const *str) {
-    while (*str)
-        if (!isspace(*(str++)))
-            return (char *)(str - 1);
-    return (char *)str;
+static intern_entry *intern(intern_table *table, graph *dependency_graph,
+                            const char *name, size_t length) {
+    if (2 * (table->size + 1) > table->capacity)
+        intern_grow(table);
+    size_t hash = hash_name(name, length);
+    size_t slot = hash & (table->capacity - 1);
+    while (table->entries[slot].name != NULL) {
+        intern_entry *e = &table->entries[slot];
+        if (e->hash == hash && e->length == length && memcmp(e->name, name, length) == 0)
+            return e;
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    intern_entry *e = &table->entries[slot];
+    e->name = arena_copy(table, name, length);
+    e->length = length;
+    e->hash = hash;
+    graph_set_vertex_value(dependency_graph, e->name, e->name);
+    e->rule = graph_get_vertex_value(dependency_graph, e->name);
+    table->size++;
+    return e;
 }
 
 /**
- * Return a pointer to the first whitespace character in `str`, or to
- * the null byte if none exists.
+ * Frees the table, leaving the chunks to the graph keys that use them.
  */
-static char *find_whitespace(char const *str) {
-    while (*str)
-        if (isspace(*(str++)))
-            return (char *)(str - 1);
-    return (char *)str;
+static void intern_destroy(intern_table *table) {
+    chunk *c = table->chunks;
+    while (c != NULL) {
+        chunk *next = c->next;
+        if (--c->refs == 0)
+            free(c);
+        c = next;
+    }
+    free(table->entries);
 }
 
 /**
- * Removes everything in `str` after the location of the first whitespace
- * character (if any) by setting that character to a null byte.
+ * Vertex value copy constructor invoked by the graph when its vertex value
+ * is set. This copy constructor takes in a string `s` and returns a rule_t
+ * struct initialized so that its target is a deep copy of `s`.
  */
-static char *terminate_whitespace(char *str) {
-    char *search = find_whitespace(str);
-    *search = '\0';
-    return search;
+static void *str_to_rule_constructor(void *s) {
+    if (!s)
+        return NULL;
+    rule_t *out = malloc(sizeof(rule_t));
+    rule_init(out);
+    out->target = (char *)string_copy_constructor(s);
+    return out;
 }
 
 /**
- * Removes all trailing whitespace characters (if any) by replacing them with
- * null bytes.
+ * Rule destructor invoked by the graph when it needs to destroy a vertex.
  */
-static char *strip_back_whitespace(char *str) {
-    size_t len = strlen(str);
-    char *back = str + len - 1;
-    while (back >= str && isspace(*back)) {
-        *back-- = '\0';
-    }
-    return str;
+static void rule_destroy_v(void *r) {
+    rule_t *rule = (rule_t *)r;
+    rule_destroy(rule);
 }
 
 /**
- * Return whether the location `ptr` in `str` is enclosed by quotes or not.
- * This is determined by counting all non-escaped quote characters
+ * Return true if the current line refers to a valid Makefile target name
  */
-static bool in_quotes(char const *str, char const *ptr) {
-    bool inQuotes = false;
-    for (char const *p = str; p < ptr; ++p) {
-        if (*p == '\\')
-            ++p;
-        else if (*p == '"')
-            inQuotes = !inQuotes;
-    }
-    return inQuotes;
+static bool is_makefile_target(char const *line) {
+    return isalnum(line[0]) || (line[0] == '.') || line[0] == '/';
 }
 
 /**
- * Identifies where comment starts (if at all) and deletes everything after
- * this point by inserting a null byte.
+ * Returns where the comment on the line from `start` to `end` begins, or
+ * `end` if it has none. A comment starts at the first `#` outside of
+ * quotes; quotes are toggled by every `"` that is not preceded by a
+ * backslash, while a `#` is a candidate even if it is escaped. The line is
+ * scanned once.
  */
-static void strip_back_comments(char *str) {
-    char *comment_str = str;
-    while ((comment_str = strstr(comment_str, "#"))) {
-        // Ignore # symbol if it occurs within quotes
-        if (!in_quotes(str, comment_str)) {
-            // Terminate comment
-            *comment_str = '\0';
-            break;
-        } else {
-            // Keep looking for comments
-            ++comment_str;
+static const char *find_comment(const char *start, const char *end) {
+    bool in_quotes = false;
+    for (const char *p = start; p < end; ++p) {
+        if (*p == '#' && !in_quotes)
+            return p;
+        if (*p == '\\') {
+            // the escaped character never toggles quotes
+            if (++p < end && *p == '#' && !in_quotes)
+                return p;
+        } else if (*p == '"') {
+            in_quotes = !in_quotes;
         }
     }
+    return end;
 }
 
 /**
- * Return a FILE pointer to the makefile at the path `makefile_name` if
- * `makefile_name` is not NULL and refers to an actual file.
+ * Loads the makefile at the path `makefile_name` if `makefile_name` is not
+ * NULL and refers to an actual file. Regular files are mapped read-only;
+ * anything else (a pipe, say) is read into memory. Returns the contents
+ * and sets `length_ref` and `mapped_ref`.
  */
-static FILE *open_makefile(const char *makefile_name, char **goals) {
+static char *load_makefile(const char *makefile_name, char **goals,
+                           size_t *length_ref, bool *mapped_ref) {
     // Open the makefile
     if (!makefile_name && (!goals || !*goals)) {
         fprintf(stderr, "parmake: *** No targets specified and no makefile "
@@ -177,52 +252,96 @@ static FILE *open_makefile(const char *makefile_name, char **goals) {
                 goals[0]);
         exit(2);
     }
-    FILE *f = fopen(makefile_name, "r");
-    if (!f) {
+    int fd = open(makefile_name, O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info) == -1) {
         fprintf(stderr, "parmake: %s: No such file or directory\n",
                 makefile_name);
         exit(2);
     }
-    return f;
+    *mapped_ref = false;
+    *length_ref = 0;
+    if (S_ISREG(info.st_mode) && info.st_size > 0) {
+        char *contents = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (contents != MAP_FAILED) {
+            madvise(contents, info.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            *mapped_ref = true;
+            *length_ref = info.st_size;
+            return contents;
+        }
+    }
+    size_t capacity = READ_CHUNK;
+    char *contents = malloc(capacity);
+    while (contents != NULL) {
+        if (*length_ref == capacity) {
+            char *bigger = realloc(contents, capacity *= 2);
+            if (bigger == NULL)
+                break;
+            contents = bigger;
+        }
+        ssize_t bytes = read(fd, contents + *length_ref, capacity - *length_ref);
+        if (bytes == -1 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+            break;
+        *length_ref += bytes;
+    }
+    close(fd);
+    if (contents == NULL) {
+        perror("parmake");
+        exit(2);
+    }
+    return contents;
 }
 
 graph *parser_parse_makefile(const char *makeFileName, char **goals) {
-    FILE *f = open_makefile(makeFileName, goals);
+    size_t length;
+    bool mapped;
+    char *contents = load_makefile(makeFileName, goals, &length, &mapped);
     graph *dependency_graph = graph_create(
-        string_hash_function, string_compare, string_copy_constructor,
-        string_destructor, str_to_rule_constructor, rule_destroy_v, NULL, NULL);
+        string_hash_function, string_compare, intern_retain, intern_release,
+        str_to_rule_constructor, rule_destroy_v, NULL, NULL);
+    intern_table table = {NULL, 0, 0, NULL};
     // capture first rule name in case user did not specify goals
     char *first_target = NULL;
 
     rule_t *curr_rule = NULL;
+    // entries move when the table grows, so the name is kept instead
+    char *curr_target = NULL;
 
-    char *lineBuf = NULL;
-    size_t bytes = 0;
-    ssize_t len = 0;
+    // commands are copied out of the file here to be NUL terminated
+    char *command = NULL;
+    size_t command_capacity = 0;
     size_t line_number = 0;
     // Used to identify redefined rules
     int in_command_block = 0;
 
     // First add sentinel vertex
-    graph_set_vertex_value(dependency_graph, "", "");
+    intern(&table, dependency_graph, "", 0);
 
-    while ((len = getline(&lineBuf, &bytes, f)) != -1) {
+    const char *file_end = contents + length;
+    for (const char *next = contents; next < file_end;) {
+        const char *line_start = next;
+        const char *end = memchr(line_start, '\n', file_end - line_start);
+        if (end == NULL)
+            end = file_end;
+        next = end + 1;
         ++line_number;
-        // Remove newline / carriage return
-        if (len && lineBuf[len - 1] == '\n') {
-            lineBuf[--len] = '\0';
-            if (len && lineBuf[len - 1] == '\r')
-                lineBuf[--len] = '\0';
-        }
 
-        strip_back_whitespace(lineBuf);
-        char *line = skip_whitespace(lineBuf);
-        strip_back_comments(line);
+        // Remove trailing whitespace (the carriage return included) and
+        // leading whitespace, then the comment
+        while (end > line_start && isspace((unsigned char)end[-1]))
+            --end;
+        const char *line = line_start;
+        while (line < end && isspace((unsigned char)*line))
+            ++line;
+        end = find_comment(line, end);
 
-        if (!(*line))
+        if (line == end)
             continue;
 
-        if (lineBuf[0] == '\t') {
+        if (line_start[0] == '\t') {
             // Recipe line
             if (!curr_rule) {
                 fprintf(stderr,
@@ -252,55 +371,68 @@ graph *parser_parse_makefile(const char *makeFileName, char **goals) {
                 }
             }
             in_command_block = 1;
-            vector_push_back(curr_rule->commands, line);
+            size_t command_length = end - line;
+            if (command_length + 1 > command_capacity) {
+                command_capacity = 2 * (command_length + 1);
+                free(command);
+                command = malloc(command_capacity);
+            }
+            memcpy(command, line, command_length);
+            command[command_length] = '\0';
+            vector_push_back(curr_rule->commands, command);
         } else if (is_makefile_target(line)) {
             in_command_block = 0;
             // Found start of new rule line
             curr_rule = NULL;
             // Find first colon to split on
-            char *depLine = strstr(line, ":");
+            const char *colon = memchr(line, ':', end - line);
             // Did we actually find it?
-            if (!depLine) {
+            if (!colon) {
                 fprintf(stderr, "%s:%zu: *** missing separator.  Stop.\n",
                         makeFileName, line_number);
                 exit(2);
             }
 
-            // Remove the colon, and setup target name and dependency string
-            depLine[0] = '\0';
-            ++depLine;
-            // Remove trailing whitespace and other nonsense
-            terminate_whitespace(line);
+            // The target ends at the colon or the first whitespace before it
+            const char *target_end = line;
+            while (target_end < colon && !isspace((unsigned char)*target_end))
+                ++target_end;
 
             // We found a new rule, so let's push this to the dependency graph
-            if (!graph_contains_vertex(dependency_graph, line)) {
-                // Found a completely new rule, so we must add it to the graph
-                graph_set_vertex_value(dependency_graph, line, line);
-                // Check if this is the first target in the Makefile, saving it
-                // if so
-                if (!first_target)
-                    first_target = string_copy_constructor(line);
-            }
-
-            curr_rule = graph_get_vertex_value(dependency_graph, line);
-            char **dependencies = split_line_on_spaces(depLine);
+            intern_entry *entry = intern(&table, dependency_graph, line, target_end - line);
+            curr_target = entry->name;
+            curr_rule = entry->rule;
+            // Check if this is the first target in the Makefile, saving it
+            // if so
+            if (!first_target)
+                first_target = curr_target;
 
-            for (char **depPtr = dependencies; *depPtr; ++depPtr) {
-                // We found a new rule, so push it to the dependency graph
-                if (!graph_contains_vertex(dependency_graph, *depPtr)) {
-                    graph_set_vertex_value(dependency_graph, *depPtr, *depPtr);
+            // Dependencies are separated by spaces
+            for (const char *dep = colon + 1; dep < end;) {
+                if (*dep == ' ') {
+                    ++dep;
+                    continue;
                 }
+                const char *dep_end = memchr(dep, ' ', end - dep);
+                if (dep_end == NULL)
+                    dep_end = end;
+                // A new dependency is pushed to the graph by intern()
+                intern_entry *dependency = intern(&table, dependency_graph, dep, dep_end - dep);
                 // Create a dependency edge
-                graph_add_edge(dependency_graph, line, *depPtr);
+                graph_add_edge(dependency_graph, curr_target, dependency->name);
+                dep = dep_end;
             }
-            free(dependencies);
         } else {
             fprintf(stderr, "%s:%zu: *** missing separator.  Stop.\n",
                     makeFileName, line_number);
             exit(2);
         }
     }
-    free(lineBuf);
+    free(command);
+    if (mapped)
+        munmap(contents, length);
+    else
+        free(contents);
     // If no goals specified, build the first rule ever defined
     char *default_targets[] = {first_target, NULL};
     if (!goals || !(*goals)) {
@@ -323,8 +455,10 @@ graph *parser_parse_makefile(const char *makeFileName, char **goals) {
 #ifdef EASY_MODE
     remove_unnecessary_targets(dependency_graph, goals);
 #endif
-    zero_out_states(dependency_graph);
-    free(first_target);
-    fclose(f);
+    // Discard all line number information from vertices for user's sake
+    for (size_t i = 0; i < table.capacity; ++i)
+        if (table.entries[i].name != NULL)
+            table.entries[i].rule->state = 0;
+    intern_destroy(&table);
     return dependency_graph;
 }
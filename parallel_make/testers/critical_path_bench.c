@@ -0,0 +1,162 @@
+/**
+* Parallel Make Lab
+* CS 241 - Fall 2018
+*/
+
+/**
+ * Critical path scheduling benchmark.
+ *
+ * Every makefile given (by default all of test_makefiles/testfile*) is
+ * copied with each of its commands replaced by a synthetic sleep of a
+ * deterministic pseudo-random length, so the files' dependency graphs are
+ * kept but their commands neither fail nor touch the file system. Commands
+ * that already sleep are kept, so files written for timing (testfile4,
+ * testfile10 and testfile11) keep the behavior they describe. Each copy
+ * is built twice with parmake: first with no stats file, when rules are
+ * weighted by their command counts, then again with the durations the first
+ * build recorded. Only wall-clock time is reported.
+ *
+ * Build parmake first, then from the parallel_make directory:
+ * 	gcc -O2 -std=c99 -D_GNU_SOURCE testers/critical_path_bench.c -o critical_path_bench
+ * 	./critical_path_bench [-j threads] [makefile ...]
+ */
+
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PARMAKE "./parmake"
+#define DEFAULT_MAKEFILES "test_makefiles/testfile*"
+#define DEFAULT_THREADS "2"
+
+// synthetic command lengths, in seconds
+static const char *sleeps[] = {"0.02", "0.05", "0.1", "0.2", "0.4"};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Writes a copy of makefile to copy with every command line that is not
+ * already a sleep replaced by one. Lengths are drawn from a generator seeded
+ * by the makefile's name, so every run of the benchmark builds the same
+ * copies.
+ */
+static int synthesize(const char *makefile, const char *copy) {
+    FILE *in = fopen(makefile, "r");
+    if (in == NULL)
+        return -1;
+    FILE *out = fopen(copy, "w");
+    if (out == NULL) {
+        fclose(in);
+        return -1;
+    }
+    unsigned seed = 5381;
+    for (const char *c = makefile; *c; ++c)
+        seed = seed * 33 + *c;
+    char *line = NULL;
+    size_t capacity = 0;
+    while (getline(&line, &capacity, in) != -1) {
+        if (line[0] == '\t' && strncmp(line + 1, "sleep ", 6) != 0) {
+            seed = seed * 1103515245 + 12345;
+            fprintf(out, "\tsleep %s\n", sleeps[(seed >> 16) % (sizeof(sleeps) / sizeof(*sleeps))]);
+        } else {
+            fputs(line, out);
+        }
+    }
+    free(line);
+    fclose(in);
+    fclose(out);
+    return 0;
+}
+
+/**
+ * Runs parmake on makefile with its output discarded and returns the wall
+ * clock time it took, or -1 if it could not be run.
+ */
+static double build(const char *makefile, const char *threads) {
+    fflush(stdout);
+    double start = now();
+    pid_t pid = fork();
+    if (pid == -1)
+        return -1;
+    if (pid == 0) {
+        freopen("/dev/null", "w", stdout);
+        freopen("/dev/null", "w", stderr);
+        execl(PARMAKE, PARMAKE, "-j", threads, "-f", makefile, (char *)NULL);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) == 127)
+        return -1;
+    return now() - start;
+}
+
+int main(int argc, char **argv) {
+    const char *threads = DEFAULT_THREADS;
+    int c;
+    while ((c = getopt(argc, argv, "j:")) != -1) {
+        if (c == 'j') {
+            threads = optarg;
+        } else {
+            fprintf(stderr, "usage: %s [-j threads] [makefile ...]\n", argv[0]);
+            return 1;
+        }
+    }
+    glob_t defaults;
+    char **makefiles = argv + optind;
+    size_t num_makefiles = argc - optind;
+    if (num_makefiles == 0) {
+        if (glob(DEFAULT_MAKEFILES, GLOB_MARK, NULL, &defaults) != 0) {
+            fprintf(stderr, "no makefiles match %s\n", DEFAULT_MAKEFILES);
+            return 1;
+        }
+        makefiles = defaults.gl_pathv;
+        num_makefiles = defaults.gl_pathc;
+    }
+
+    char copy[] = "/tmp/parmake_bench_XXXXXX";
+    int fd = mkstemp(copy);
+    if (fd == -1) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+    char stats[sizeof(copy) + sizeof(".stats")];
+    snprintf(stats, sizeof(stats), "%s.stats", copy);
+
+    printf("%-32s %10s %10s %8s\n", "makefile", "cold (s)", "warm (s)", "speedup");
+    double total_cold = 0, total_warm = 0;
+    for (size_t i = 0; i < num_makefiles; ++i) {
+        // skip directories and stats files left by earlier builds
+        size_t length = strlen(makefiles[i]);
+        if (makefiles[i][length - 1] == '/' ||
+            (length > 6 && strcmp(makefiles[i] + length - 6, ".stats") == 0))
+            continue;
+        if (synthesize(makefiles[i], copy) != 0)
+            continue;
+        unlink(stats);
+        double cold = build(copy, threads);
+        double warm = build(copy, threads);
+        if (cold < 0 || warm < 0) {
+            fprintf(stderr, "could not run %s\n", PARMAKE);
+            break;
+        }
+        total_cold += cold;
+        total_warm += warm;
+        printf("%-32s %10.3f %10.3f %7.2fx\n", makefiles[i], cold, warm, cold / warm);
+    }
+    printf("%-32s %10.3f %10.3f %7.2fx\n", "total", total_cold, total_warm,
+           total_warm > 0 ? total_cold / total_warm : 0);
+    unlink(copy);
+    unlink(stats);
+    if (argc == optind)
+        globfree(&defaults);
+    return 0;
+}
@@ -0,0 +1,131 @@
+/**
+* Parallel Make Lab
+* CS 241 - Fall 2018
+*/
+
+/**
+ * Makefile parsing benchmark.
+ *
+ * Generates a Makefile shaped like a large generated build (by default
+ * 100000 object rules, each depending on its source, a handful of shared
+ * headers and, now and then, earlier objects, with two commands and some
+ * comments, quoting included), then times parser_parse_makefile on it and
+ * on every makefile given. Each file is parsed several times and the best
+ * wall-clock time is reported, along with the size of the graph as a
+ * sanity check.
+ *
+ * From the parallel_make directory:
+ * 	gcc -O2 -std=c99 -D_GNU_SOURCE -I. -I./includes testers/parse_bench.c parser.c rule.c -Llibs -lprovided -pthread -o parse_bench
+ * 	./parse_bench [-n rules] [-r runs] [makefile ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "graph.h"
+#include "parser.h"
+
+#define DEFAULT_RULES 100000
+#define DEFAULT_RUNS 3
+#define HEADERS 64
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Writes the synthetic makefile with num_rules object rules to path. The
+ * generator is seeded with a constant, so every run writes the same file.
+ */
+static int generate(const char *path, size_t num_rules) {
+    FILE *out = fopen(path, "w");
+    if (out == NULL)
+        return -1;
+    unsigned seed = 5381;
+    fprintf(out, "# generated by parse_bench\n");
+    fprintf(out, "all: link\n\n");
+    fprintf(out, "link:");
+    for (size_t i = 0; i < num_rules; ++i)
+        fprintf(out, " obj/file%zu.o", i);
+    fprintf(out, "\n\techo \"linking # everything\" > link # done\n\n");
+    for (size_t i = 0; i < num_rules; ++i) {
+        if (i % 100 == 0)
+            fprintf(out, "# objects %zu to %zu, \"quoted # not a comment\"\n", i, i + 99);
+        fprintf(out, "obj/file%zu.o: src/file%zu.c", i, i);
+        for (int j = 0; j < 4; ++j) {
+            seed = seed * 1103515245 + 12345;
+            fprintf(out, " include/header%u.h", (seed >> 16) % HEADERS);
+        }
+        seed = seed * 1103515245 + 12345;
+        if (i > 0 && (seed >> 16) % 8 == 0)
+            fprintf(out, " obj/file%u.o", (seed >> 4) % (unsigned)i);
+        fprintf(out, "\n\tgcc -O2 -c src/file%zu.c -o obj/file%zu.o -DNAME=\\\"file%zu\\\"\n", i, i, i);
+        fprintf(out, "\t@echo \"built file%zu.o\"   # progress\n\n", i);
+    }
+    for (int i = 0; i < HEADERS; ++i)
+        fprintf(out, "include/header%d.h:\n\n", i);
+    fclose(out);
+    return 0;
+}
+
+/**
+ * Parses makefile runs times and prints the best time and the graph size.
+ */
+static void bench(const char *makefile, int runs) {
+    double best = -1;
+    size_t vertices = 0, edges = 0;
+    for (int i = 0; i < runs; ++i) {
+        double start = now();
+        graph *g = parser_parse_makefile(makefile, NULL);
+        double elapsed = now() - start;
+        vertices = graph_vertex_count(g);
+        edges = graph_edge_count(g);
+        graph_destroy(g);
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+    }
+    printf("%-32s %10zu %10zu %10.3f\n", makefile, vertices, edges, best);
+}
+
+int main(int argc, char **argv) {
+    size_t num_rules = DEFAULT_RULES;
+    int runs = DEFAULT_RUNS;
+    int c;
+    while ((c = getopt(argc, argv, "n:r:")) != -1) {
+        if (c == 'n') {
+            num_rules = strtoul(optarg, NULL, 10);
+        } else if (c == 'r') {
+            runs = atoi(optarg);
+        } else {
+            fprintf(stderr, "usage: %s [-n rules] [-r runs] [makefile ...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (runs < 1)
+        runs = 1;
+
+    char generated[] = "/tmp/parmake_parse_XXXXXX";
+    int fd = mkstemp(generated);
+    if (fd == -1) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+    if (generate(generated, num_rules) != 0) {
+        perror(generated);
+        unlink(generated);
+        return 1;
+    }
+
+    printf("%-32s %10s %10s %10s\n", "makefile", "vertices", "edges", "parse (s)");
+    bench(generated, runs);
+    for (int i = optind; i < argc; ++i)
+        bench(argv[i], runs);
+    unlink(generated);
+    return 0;
+}
@@ -0,0 +1,138 @@
+/**
+* Parallel Make Lab
+* CS 241 - Fall 2018
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+static FILE *trace_file = NULL;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct timespec trace_start;
+// whether an event has been written yet, to place the commas
+static bool trace_first = true;
+
+/**
+ * Writes 'string' as a JSON string literal. Called with trace_lock held.
+ */
+static void write_string(const char *string) {
+    fputc('"', trace_file);
+    for (const unsigned char *c = (const unsigned char *)string; *c; ++c) {
+        switch (*c) {
+        case '"':
+            fputs("\\\"", trace_file);
+            break;
+        case '\\':
+            fputs("\\\\", trace_file);
+            break;
+        case '\n':
+            fputs("\\n", trace_file);
+            break;
+        case '\t':
+            fputs("\\t", trace_file);
+            break;
+        default:
+            if (*c < 0x20)
+                fprintf(trace_file, "\\u%04x", *c);
+            else
+                fputc(*c, trace_file);
+        }
+    }
+    fputc('"', trace_file);
+}
+
+/**
+ * Writes the fields every event shares and leaves the object open. Called
+ * with trace_lock held.
+ */
+static void begin_event(const char *phase, int tid, const char *category,
+                        const char *name) {
+    fputs(trace_first ? "\n" : ",\n", trace_file);
+    trace_first = false;
+    fprintf(trace_file, "{\"ph\":\"%s\",\"pid\":%d,\"tid\":%d,\"cat\":", phase,
+            (int)getpid(), tid);
+    write_string(category);
+    fputs(",\"name\":", trace_file);
+    write_string(name);
+}
+
+int trace_open(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+        return -1;
+    pthread_mutex_lock(&trace_lock);
+    trace_file = file;
+    trace_first = true;
+    clock_gettime(CLOCK_MONOTONIC, &trace_start);
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", trace_file);
+    pthread_mutex_unlock(&trace_lock);
+    trace_thread_name(0, "main");
+    return 0;
+}
+
+bool trace_enabled(void) {
+    return trace_file != NULL;
+}
+
+uint64_t trace_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - trace_start.tv_sec) * 1000000 +
+           (now.tv_nsec - trace_start.tv_nsec) / 1000;
+}
+
+void trace_thread_name(int tid, const char *name) {
+    if (!trace_enabled())
+        return;
+    pthread_mutex_lock(&trace_lock);
+    begin_event("M", tid, "__metadata", "thread_name");
+    fputs(",\"args\":{\"name\":", trace_file);
+    write_string(name);
+    fputs("}}", trace_file);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_span(int tid, const char *category, const char *name,
+                uint64_t start, uint64_t end) {
+    if (!trace_enabled())
+        return;
+    pthread_mutex_lock(&trace_lock);
+    begin_event("X", tid, category, name);
+    fprintf(trace_file, ",\"ts\":%llu,\"dur\":%llu}", (unsigned long long)start,
+            (unsigned long long)(end - start));
+    pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_rule(int tid, const char *target, uint64_t start,
+                uint64_t checked, uint64_t end, char **commands,
+                size_t num_commands, int exit_status, int state) {
+    if (!trace_enabled())
+        return;
+    pthread_mutex_lock(&trace_lock);
+    begin_event("X", tid, "rule", target);
+    fprintf(trace_file, ",\"ts\":%llu,\"dur\":%llu,\"args\":{\"should_run_us\":%llu,"
+                        "\"state\":%d,\"exit_status\":%d,\"commands\":[",
+            (unsigned long long)start, (unsigned long long)(end - start),
+            (unsigned long long)(checked - start), state, exit_status);
+    for (size_t i = 0; i < num_commands; ++i) {
+        if (i > 0)
+            fputc(',', trace_file);
+        write_string(commands[i]);
+    }
+    fputs("]}}", trace_file);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_close(void) {
+    pthread_mutex_lock(&trace_lock);
+    if (trace_file != NULL) {
+        fputs("\n]}\n", trace_file);
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
@@ -0,0 +1,63 @@
+/**
+* Parallel Make Lab
+* CS 241 - Fall 2018
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Build timeline in Chrome's trace event format (load the file in
+ * chrome://tracing or https://ui.perfetto.dev).
+ *
+ * Every event is a complete ("X") event on one thread of the parmake
+ * process: thread 0 is the main thread, and worker n is thread n + 1. All
+ * functions are thread-safe, and do nothing unless trace_open() succeeded.
+ * parmake writes one to the file named by PARMAKE_TRACE, if set.
+ */
+
+/**
+ * Starts writing a trace to 'path'. Timestamps are relative to this call.
+ * Returns 0 on success and -1 if the file cannot be created.
+ */
+int trace_open(const char *path);
+
+/**
+ * Returns whether a trace is being written.
+ */
+bool trace_enabled(void);
+
+/**
+ * Returns the current time in microseconds since trace_open().
+ */
+uint64_t trace_now(void);
+
+/**
+ * Names thread 'tid' in the trace viewer.
+ */
+void trace_thread_name(int tid, const char *name);
+
+/**
+ * Records a span named 'name' in 'category' on thread 'tid' from 'start' to
+ * 'end' (both from trace_now()).
+ */
+void trace_span(int tid, const char *category, const char *name,
+                uint64_t start, uint64_t end);
+
+/**
+ * Records one rule: it was picked up at 'start', should_run took until
+ * 'checked', and it finished at 'end'. 'commands' are the ones that were
+ * run, 'exit_status' is the status of the last of them (or -1 if none ran),
+ * and 'state' is the rule's final state.
+ */
+void trace_rule(int tid, const char *target, uint64_t start,
+                uint64_t checked, uint64_t end, char **commands,
+                size_t num_commands, int exit_status, int state);
+
+/**
+ * Finishes the JSON document and closes the trace file.
+ */
+void trace_close(void);
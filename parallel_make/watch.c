@@ -0,0 +1,153 @@
+/**
+* Parallel Make Lab
+* CS 241 - Fall 2018
+*/
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "watch.h"
+
+// everything that can change a file's existence or modification time
+#define WATCH_MASK                                                             \
+    (IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM |           \
+     IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#define EVENT_BUFFER 65536
+
+/**
+ * A watched file: its name within the directory with watch descriptor wd.
+ * Entries are chained in the table by the hash of both.
+ */
+typedef struct entry {
+    int wd;
+    char *name;
+    void *data;
+    struct entry *next;
+} entry;
+
+static int inotify_fd = -1;
+static entry **table = NULL;
+static size_t num_buckets = 0;
+static size_t num_entries = 0;
+
+static size_t hash_name(int wd, const char *name) {
+    size_t hash = 5381 + (size_t)wd;
+    for (const unsigned char *c = (const unsigned char *)name; *c; ++c)
+        hash = hash * 33 + *c;
+    return hash;
+}
+
+/**
+ * Doubles the table once it averages more than one entry per bucket.
+ */
+static void grow_table(void) {
+    size_t new_buckets = num_buckets ? 2 * num_buckets : 256;
+    entry **new_table = calloc(new_buckets, sizeof(entry *));
+    if (new_table == NULL)
+        return;
+    for (size_t i = 0; i < num_buckets; ++i) {
+        while (table[i] != NULL) {
+            entry *e = table[i];
+            table[i] = e->next;
+            size_t bucket = hash_name(e->wd, e->name) & (new_buckets - 1);
+            e->next = new_table[bucket];
+            new_table[bucket] = e;
+        }
+    }
+    free(table);
+    table = new_table;
+    num_buckets = new_buckets;
+}
+
+int watch_init(void) {
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    return inotify_fd;
+}
+
+int watch_add(const char *path, void *data) {
+    const char *slash = strrchr(path, '/');
+    const char *name = slash ? slash + 1 : path;
+    if (*name == '\0' || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        return -1;
+    char dir[PATH_MAX];
+    if (slash == NULL) {
+        strcpy(dir, ".");
+    } else if (slash == path) {
+        strcpy(dir, "/");
+    } else {
+        if ((size_t)(slash - path) >= sizeof(dir))
+            return -1;
+        memcpy(dir, path, slash - path);
+        dir[slash - path] = '\0';
+    }
+    // the kernel hands out one descriptor per directory, however it is named
+    int wd = inotify_add_watch(inotify_fd, dir, WATCH_MASK);
+    if (wd == -1)
+        return -1;
+    if (num_entries >= num_buckets)
+        grow_table();
+    entry *e = malloc(sizeof(entry));
+    if (e == NULL || table == NULL || (e->name = strdup(name)) == NULL) {
+        free(e);
+        return -1;
+    }
+    e->wd = wd;
+    e->data = data;
+    size_t bucket = hash_name(wd, name) & (num_buckets - 1);
+    e->next = table[bucket];
+    table[bucket] = e;
+    num_entries++;
+    return 0;
+}
+
+int watch_read(void (*changed)(void *data)) {
+    // aligned as the kernel writes inotify_event structs into it
+    char buffer[EVENT_BUFFER] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int lost = 0;
+    while (true) {
+        ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+        if (length == -1 && errno == EINTR)
+            continue;
+        if (length <= 0)
+            return lost;
+        for (char *c = buffer; c < buffer + length;) {
+            struct inotify_event *event = (struct inotify_event *)c;
+            c += sizeof(struct inotify_event) + event->len;
+            if (event->mask & (IN_Q_OVERFLOW | IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                lost = 1;
+                continue;
+            }
+            if (event->len == 0 || num_buckets == 0)
+                continue;
+            size_t bucket = hash_name(event->wd, event->name) & (num_buckets - 1);
+            for (entry *e = table[bucket]; e != NULL; e = e->next)
+                if (e->wd == event->wd && strcmp(e->name, event->name) == 0)
+                    changed(e->data);
+        }
+    }
+}
+
+void watch_destroy(void) {
+    for (size_t i = 0; i < num_buckets; ++i) {
+        while (table[i] != NULL) {
+            entry *e = table[i];
+            table[i] = e->next;
+            free(e->name);
+            free(e);
+        }
+    }
+    free(table);
+    table = NULL;
+    num_buckets = 0;
+    num_entries = 0;
+    // closing the instance drops its watches
+    if (inotify_fd != -1)
+        close(inotify_fd);
+    inotify_fd = -1;
+}
@@ -0,0 +1,43 @@
+/**
+* Parallel Make Lab
+* CS 241 - Fall 2018
+*/
+
+#pragma once
+
+/**
+ * File change notification for the parmake server, on top of inotify.
+ *
+ * Directories are watched rather than the files themselves, so a file that
+ * does not exist yet, or is replaced by a rename, is still seen. Every file
+ * added is tagged with a pointer that is handed back when it changes. Only
+ * one set of watches exists at a time.
+ */
+
+/**
+ * Creates the inotify instance.
+ * Returns its file descriptor, which becomes readable when events are
+ * pending, or -1 on failure.
+ */
+int watch_init(void);
+
+/**
+ * Watches the file at 'path', tagging it with 'data'. The same file may be
+ * added more than once, under different tags.
+ * Returns 0 on success and -1 if its directory cannot be watched.
+ */
+int watch_add(const char *path, void *data);
+
+/**
+ * Reads every pending event without blocking and calls 'changed' with the
+ * tag of each watched file that was created, modified, deleted or renamed.
+ * Returns 1 if events were lost (the queue overflowed, or a watched
+ * directory went away), after which every file must be assumed changed, and
+ * 0 otherwise.
+ */
+int watch_read(void (*changed)(void *data));
+
+/**
+ * Removes every watch and closes the inotify instance.
+ */
+void watch_destroy(void);